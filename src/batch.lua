@@ -0,0 +1,95 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+
+-- The number of serialized bytes after which a batch is sent without waiting for it to be flushed.
+local maxBatchSize = 65536
+
+---@class Batch
+---@field _messages string[] The serialized messages, in the order they were added.
+---@field _size integer The total size of the serialized messages.
+local Batch = {}
+Batch.__index = Batch
+
+---Constructs and returns a new, empty batch.
+---@return Batch
+function Batch.new()
+  local batch = setmetatable({
+    _messages = {},
+    _size = 0,
+  }, Batch)
+
+  return batch
+end
+
+---Adds a serialized message to the batch.
+---@param message string The serialized message.
+---@return boolean # Whether the batch has grown large enough that it should be sent.
+function Batch:add(message)
+  self._messages[#self._messages + 1] = message
+  self._size = self._size + util.lenSize + #message
+
+  return self._size >= maxBatchSize
+end
+
+---Does the batch contain no messages?
+---@return boolean
+function Batch:empty()
+  return #self._messages == 0
+end
+
+---Encodes the batch into a single frame and empties it. A batch of a single message is encoded as an ordinary data frame.
+---@param key string? The AES key, or nil to leave the payload unencrypted.
+---@return string # The encoded frame, including its size prefix.
+function Batch:encode(key)
+  local messages = self._messages
+  self._messages = {}
+  self._size = 0
+
+  if #messages == 1 then
+    return frame.encode(key, frame.kinds.data, messages[1])
+  end
+
+  local parts = {}
+
+  for _, message in ipairs(messages) do
+    parts[#parts + 1] = util.encodeMessageSize(#message)
+    parts[#parts + 1] = message
+  end
+
+  return frame.encode(key, frame.kinds.batch, table.concat(parts))
+end
+
+---Returns an iterator over the serialized messages in the payload of a batch frame. The iterator raises an error if the payload ends partway through a message.
+---@param payload string The decrypted payload.
+---@return fun(): string? # The iterator.
+local function messages(payload)
+  local offset = 1
+
+  return function ()
+    if offset > #payload then
+      return nil
+    end
+
+    if offset + util.lenSize - 1 > #payload then
+      error("malformed batch: truncated message size")
+    end
+
+    local size = util.decodeMessageSize(string.sub(payload, offset, offset + util.lenSize - 1))
+    local last = offset + util.lenSize + size - 1
+    if last > #payload then
+      error("malformed batch: truncated message")
+    end
+
+    local message = string.sub(payload, offset + util.lenSize, last)
+    offset = last + 1
+
+    return message
+  end
+end
+
+return {
+  Batch = Batch,
+  messages = messages,
+}
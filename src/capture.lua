@@ -0,0 +1,122 @@
+---@module "src.util"
+local util = require("luadtp.util")
+local socket = require("socket")
+
+-- The bytes every capture file starts with.
+local magic = "LDTPCAP\1"
+
+-- The size of a record's timestamp, in microseconds since the capture started.
+local timeSize = 8
+
+-- The size of a record's client ID.
+local clientIdSize = 4
+
+-- The size of a record's header: the timestamp, the client ID, the record type and the data size.
+local recordHeaderSize = timeSize + clientIdSize + 1 + util.lenSize
+
+-- The types of records that are not frames. Frame records use the frame kind as their type.
+local recordTypes = {
+  connect = 254,
+  disconnect = 255,
+}
+
+---@class CaptureRecord
+---@field time number The number of seconds between the start of the capture and the record.
+---@field clientId integer The ID of the client the record concerns.
+---@field type integer The frame kind, or one of the non-frame record types.
+---@field data string The frame header followed by the decrypted frame payload, or an empty string for non-frame records.
+
+---@class CaptureWriter
+---@field _file file* The capture file.
+---@field _start number The time at which the capture started.
+local CaptureWriter = {}
+CaptureWriter.__index = CaptureWriter
+
+---Creates a capture file, replacing any existing file at the path.
+---@param path string The path of the capture file.
+---@return CaptureWriter
+function CaptureWriter.open(path)
+  local file, err = io.open(path, "wb")
+  if file == nil then
+    error("capture open error: " .. err)
+  end
+
+  file:setvbuf("full")
+  file:write(magic)
+
+  return setmetatable({
+    _file = file,
+    _start = socket.gettime(),
+  }, CaptureWriter)
+end
+
+---Appends a record to the capture.
+---@param clientId integer The ID of the client the record concerns.
+---@param recordType integer The frame kind, or one of the non-frame record types.
+---@param data string? The frame header followed by the decrypted frame payload.
+function CaptureWriter:record(clientId, recordType, data)
+  data = data or ""
+  local time = math.floor((socket.gettime() - self._start) * 1000000)
+
+  self._file:write(
+    util.encodeInteger(time, timeSize),
+    util.encodeInteger(clientId, clientIdSize),
+    string.char(recordType),
+    util.encodeMessageSize(#data),
+    data
+  )
+end
+
+---Flushes and closes the capture file.
+function CaptureWriter:close()
+  self._file:close()
+end
+
+---Returns an iterator over the records of a capture file, in the order they were captured.
+---@param path string The path of the capture file.
+---@return fun(): CaptureRecord? # The iterator, which closes the file once it is exhausted.
+local function records(path)
+  local file, err = io.open(path, "rb")
+  if file == nil then
+    error("capture open error: " .. err)
+  end
+
+  if file:read(#magic) ~= magic then
+    file:close()
+    error("capture read error: not a capture file")
+  end
+
+  return function ()
+    if file == nil then
+      return nil
+    end
+
+    local header = file:read(recordHeaderSize)
+    if header == nil or #header < recordHeaderSize then
+      file:close()
+      file = nil
+      return nil
+    end
+
+    local size = util.decodeMessageSize(string.sub(header, recordHeaderSize - util.lenSize + 1))
+    local data = size > 0 and file:read(size) or ""
+    if data == nil or #data < size then
+      file:close()
+      file = nil
+      error("capture read error: truncated record")
+    end
+
+    return {
+      time = util.decodeInteger(header, 1, timeSize) / 1000000,
+      clientId = util.decodeInteger(header, timeSize + 1, clientIdSize),
+      type = string.byte(header, timeSize + clientIdSize + 1),
+      data = data,
+    }
+  end
+end
+
+return {
+  CaptureWriter = CaptureWriter,
+  records = records,
+  recordTypes = recordTypes,
+}
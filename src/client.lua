@@ -2,6 +2,26 @@
 local util = require("luadtp.util")
 ---@module "src.crypto"
 local crypto = require("luadtp.crypto")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+---@module "src.shm"
+local shm = require("luadtp.shm")
+---@module "src.datagram"
+local datagram = require("luadtp.datagram")
+---@module "src.timer"
+local timer = require("luadtp.timer")
+---@module "src.rpc"
+local rpc = require("luadtp.rpc")
+---@module "src.stream"
+local stream = require("luadtp.stream")
+---@module "src.state"
+local stateImpl = require("luadtp.state")
+---@module "src.message"
+local messageImpl = require("luadtp.message")
+---@module "src.batch"
+local batch = require("luadtp.batch")
+---@module "src.reactor"
+local reactor = require("luadtp.reactor")
 local socket = require("socket")
 
 ---@class ClientInner
@@ -15,10 +35,53 @@ local socket = require("socket")
 ---@class Client
 ---@field _isConnected boolean Whether the client is connected to a server.
 ---@field _sock ClientInner The underlying client socket.
----@field _key string The AES encryption key.
+---@field _key string? The AES encryption key, or nil if the connection is not encrypted.
+---@field _routedKey string? The key routed messages are sealed with, or nil if the connection is not encrypted.
+---@field _udp table? The socket datagrams are exchanged through, once the server has enabled the datagram channel.
+---@field _udpToken string? The token identifying this client's datagrams.
+---@field _udpKey string? The key datagrams are encrypted with.
+---@field _udpSendSeq integer The sequence number of the last datagram sent.
+---@field _udpRecvSeq integer The sequence number of the last datagram accepted.
+---@field _udpRegistered boolean Whether the server has acknowledged the datagram channel.
+---@field _udpRegisteredAt number The time at which the datagram channel registration was last sent.
+---@field _timers TimerWheel The timers that fail calls once their timeouts elapse.
+---@field _calls { [integer]: Call } The calls awaiting a response, keyed by correlation ID.
+---@field _callBytes integer The total size of the requests of calls awaiting a response.
+---@field _nextCallId integer The correlation ID of the next call.
+---@field _outbox Outbox? The stream messages waiting to be sent to the server.
+---@field _inbox Inbox? The partially received stream messages from the server.
+---@field _streamWeights { [integer]: number } The scheduling weights of outgoing streams, keyed by stream ID.
+---@field _rawBuffer Buffer The buffer raw frames are encoded into, which is reused between sends.
+---@field _states { [string]: SyncedState } The states published by the server, keyed by name.
+---@field _batch Batch? The messages waiting to be sent together, or nil if the client is not batching.
+---@field _connecting PendingConnection? The connection being opened without blocking, if any.
+---@field _readSize integer? The size of the frame being received, once its size prefix has been received.
+---@field _readPartial string The bytes received so far of the size prefix or frame currently being received.
+
+---@class PendingConnection
+---@field sock ClientInner The connection being opened.
+---@field host string The server host address.
+---@field port integer? The server port.
+---@field established boolean Whether the underlying connection has been established.
+---@field exchangesKeys boolean Whether the connection performs a key exchange.
+---@field publicKeySize integer? The size of the server's public key, once it has been received.
+---@field received string The bytes received so far of the field currently being received.
+---@field key string? The AES key, once the server's public key has been received.
+---@field outgoing string? The encrypted AES key message, until it has been sent completely.
+---@field outgoingOffset integer The index of the first unsent byte of the encrypted AES key message.
+
+---@class SyncedState
+---@field version integer The version of the state the client holds.
+---@field data table The reconstructed state.
 local Client = {}
 Client.__index = Client
 
+-- The maximum number of datagrams received in a single client cycle.
+local maxDatagramsPerCycle = 64
+
+-- How often to repeat the datagram channel registration until the server acknowledges it, in seconds.
+local registrationInterval = 0.25
+
 ---Performs a cryptographic key exchange with the server.
 ---@param client Client The network client.
 local function exchangeKeys(client)
@@ -49,28 +112,231 @@ local function exchangeKeys(client)
   client._key = key
 end
 
+---Sends an empty datagram so that the server learns which address to send datagrams to.
+---@param client Client The network client.
+local function registerDatagrams(client)
+  client._udpSendSeq = client._udpSendSeq + 1
+  client._udp:send(datagram.seal(client._udpKey, client._udpToken, datagram.directions.toServer, client._udpSendSeq, ""))
+  client._udpRegisteredAt = socket.gettime()
+end
+
+---Opens the datagram channel using the token assigned by the server.
+---@param client Client The network client.
+---@param token string The token.
+local function bindDatagrams(client, token)
+  local host, port = client._sock:getpeername()
+  local udp = socket.udp()
+  udp:setpeername(host, port)
+  udp:settimeout(0)
+  client._udp = udp
+  client._udpToken = token
+  client._udpKey = datagram.deriveKey(client._key)
+  client._udpSendSeq = 0
+  client._udpRecvSeq = 0
+  client._udpRegistered = false
+  registerDatagrams(client)
+end
+
+---Closes the datagram channel, if it is open.
+---@param client Client The network client.
+local function closeDatagrams(client)
+  if client._udp ~= nil then
+    client._udp:close()
+    client._udp = nil
+  end
+end
+
+---Receives pending datagrams and triggers events for them.
+---@param client Client The network client.
+local function handleDatagrams(client)
+  if not client._udpRegistered and socket.gettime() - client._udpRegisteredAt >= registrationInterval then
+    registerDatagrams(client)
+  end
+
+  for _ = 1, maxDatagramsPerCycle do
+    local packet = client._udp:receive()
+    if packet == nil then
+      break
+    end
+
+    if datagram.token(packet) == client._udpToken then
+      local seq, payload = datagram.open(client._udpKey, packet, datagram.directions.toClient, client._udpRecvSeq)
+
+      if seq ~= nil then
+        client._udpRecvSeq = seq
+        client._udpRegistered = true
+
+        if #payload > 0 then
+          local data = util.deserialize(payload)
+          coroutine.yield({ eventType = "receiveUnreliable", data = data })
+        end
+      end
+    end
+  end
+end
+
+---Sends an encoded frame to the server.
+---@param client Client The network client.
+---@param buffer string|Buffer The encoded frame.
+local function sendFrame(client, buffer)
+  local n, err = client._outbox:send(buffer)
+  if err ~= nil then
+    error("client socket send error: " .. err)
+  end
+
+  if n ~= #buffer then
+    error("client socket did not send all bytes (" .. n .. "/" .. #buffer .. ")")
+  end
+end
+
+---Receives part of a frame from the server without blocking. Bytes that arrive before the whole frame has been received are kept for the next attempt.
+---@param client Client The network client.
+---@return string? # The frame body, excluding the size prefix, if it has been received completely.
+---@return string? # An error message, if the connection failed or has not received the whole frame yet.
+local function receiveFrame(client)
+  -- LuaSocket counts the bytes passed as a prefix towards the number of bytes to receive
+  if client._readSize == nil then
+    local size, err, partial = client._sock:receive(util.lenSize, client._readPartial)
+    if size == nil then
+      if err == "timeout" and partial ~= nil then
+        client._readPartial = partial
+      end
+
+      return nil, err
+    end
+
+    client._readSize = util.decodeMessageSize(size)
+    client._readPartial = ""
+  end
+
+  local buffer, err, partial = client._sock:receive(client._readSize, client._readPartial)
+  if buffer == nil then
+    if err == "timeout" and partial ~= nil then
+      client._readPartial = partial
+    end
+
+    return nil, err
+  end
+
+  client._readSize = nil
+  client._readPartial = ""
+
+  return buffer, nil
+end
+
+---Completes the call a response belongs to.
+---@param client Client The network client.
+---@param callId string The encoded correlation ID of the call.
+---@param payload string The serialized outcome of the call.
+local function handleResponse(client, callId, payload)
+  local id = util.decodeInteger(callId, 1, rpc.callIdSize)
+  local call = client._calls[id]
+  if call == nil then
+    return
+  end
+
+  client._calls[id] = nil
+  client._callBytes = client._callBytes - call._size
+  local response = util.deserialize(payload)
+  call:_complete(response[1], response[2])
+end
+
+---Applies a state update from the server and triggers an event for it. Updates that cannot be applied to the state the client holds are dropped, and the server is asked for a full snapshot instead.
+---@param client Client The network client.
+---@param payload string The serialized update.
+local function handleState(client, payload)
+  local update = util.deserialize(payload)
+  local name, version, baseline = update[1], update[2], update[3]
+  local current = client._states[name]
+
+  if baseline == 0 then
+    current = { version = version, data = update[4] }
+    client._states[name] = current
+  elseif current ~= nil and current.version == baseline then
+    stateImpl.apply(current.data, { set = update[4], removed = update[5] })
+    current.version = version
+  else
+    sendFrame(client, frame.encode(client._key, frame.kinds.stateResync, util.serialize(name)))
+    return
+  end
+
+  coroutine.yield({ eventType = "state", name = name, data = current.data })
+end
+
+---Fails every call that is still awaiting a response.
+---@param client Client The network client.
+local function failCalls(client)
+  local calls = client._calls
+  client._calls = {}
+  client._callBytes = 0
+
+  for _, call in pairs(calls) do
+    call:_complete(false, "disconnected")
+  end
+end
+
 ---Performs a single polling and event-triggering cycle.
 ---@param client Client The network client.
 local function handle(client)
   while client._isConnected do
-    local size, err = client._sock:receive(util.lenSize)
-    if err == nil then
-      local msgSize = util.decodeMessageSize(size)
-      local buffer, err = client._sock:receive(msgSize)
-      if err ~= nil then
+    client._timers:advance()
+
+    if client._outbox:flush() ~= nil then
+      break
+    end
+
+    local buffer, err = receiveFrame(client)
+    if buffer ~= nil then
+      local kind, payload, header = frame.decode(client._key, buffer)
+      if kind == nil then
         break
-      end
+      elseif kind == frame.kinds.data then
+        local data = util.deserialize(payload)
+        coroutine.yield({ eventType = "receive", data = data })
+      elseif kind == frame.kinds.batch then
+        for message in batch.messages(payload) do
+          coroutine.yield({ eventType = "receive", data = util.deserialize(message) })
 
-      local bufferDecrypted = crypto.aesDecrypt(client._key, buffer)
-      local data = util.deserialize(bufferDecrypted)
-      coroutine.yield({ eventType = "receive", data = data })
+          if not client._isConnected then
+            break
+          end
+        end
+      elseif kind == frame.kinds.state then
+        handleState(client, payload)
+      elseif kind == frame.kinds.raw then
+        coroutine.yield({ eventType = "receiveRaw", data = payload })
+      elseif kind == frame.kinds.routed then
+        coroutine.yield({ eventType = "receiveRouted", message = messageImpl.Message.new(client._routedKey, header, payload) })
+      elseif kind == frame.kinds.publish then
+        local message = util.deserialize(payload)
+        coroutine.yield({ eventType = "receive", data = message[2], topic = message[1] })
+      elseif kind == frame.kinds.chunk then
+        local streamId, message = client._inbox:add(header, payload)
+        if message ~= nil then
+          local data = util.deserialize(message)
+          coroutine.yield({ eventType = "receive", data = data, stream = streamId })
+        end
+      elseif kind == frame.kinds.response then
+        handleResponse(client, header, payload)
+      elseif kind == frame.kinds.ping then
+        client._outbox:send(frame.encode(nil, frame.kinds.pong))
+      elseif kind == frame.kinds.udpBind then
+        bindDatagrams(client, payload)
+      end
     elseif err ~= "timeout" then
       break
     end
 
+    if client._udp ~= nil then
+      handleDatagrams(client)
+    end
+
     coroutine.yield()
   end
 
+  closeDatagrams(client)
+  failCalls(client)
+
   if client._isConnected then
     client._isConnected = false
     client._sock:close()
@@ -78,6 +344,106 @@ local function handle(client)
   end
 end
 
+---Starts handling a connection once it is open and its key exchange, if any, is complete.
+---@param client Client The network client.
+---@return thread # A coroutine that must be polled to handle client events.
+local function start(client)
+  client._routedKey = client._key and messageImpl.deriveKey(client._key)
+  client._readSize = nil
+  client._readPartial = ""
+  client._sock:settimeout(0)
+  client._states = {}
+  client._outbox = stream.Outbox.new(client._sock, client._key, client._streamWeights)
+  client._inbox = stream.Inbox.new()
+
+  local co = coroutine.create(function ()
+    handle(client)
+  end)
+
+  return co
+end
+
+---Receives a fixed-size field of a key exchange without blocking. Bytes that arrive before the whole field has been received are kept for the next attempt.
+---@param connecting PendingConnection The connection being opened.
+---@param size integer The size of the field.
+---@return string? # The field, if it has been received completely.
+local function receiveConnectField(connecting, size)
+  -- LuaSocket counts the bytes passed as a prefix towards the number of bytes to receive
+  local data, err, partial = connecting.sock:receive(size, connecting.received)
+  if data ~= nil then
+    connecting.received = ""
+    return data
+  end
+
+  if err ~= "timeout" then
+    error("client key exchange error: " .. err)
+  end
+
+  if partial ~= nil then
+    connecting.received = partial
+  end
+
+  return nil
+end
+
+---Advances a connection being opened, and its key exchange, as far as possible without blocking.
+---@param connecting PendingConnection The connection being opened.
+---@return boolean # Whether the connection is open and its key exchange complete.
+local function progressConnect(connecting)
+  if not connecting.established then
+    local ok, err = connecting.sock:connect(connecting.host, connecting.port)
+    if ok == nil and err ~= "already connected" then
+      if err == "timeout" or err == "Operation already in progress" then
+        return false
+      end
+
+      error("client socket connect error: " .. err)
+    end
+
+    connecting.established = true
+  end
+
+  if not connecting.exchangesKeys then
+    return true
+  end
+
+  if connecting.key == nil then
+    if connecting.publicKeySize == nil then
+      local size = receiveConnectField(connecting, util.lenSize)
+      if size == nil then
+        return false
+      end
+
+      connecting.publicKeySize = util.decodeMessageSize(size)
+    end
+
+    local publicKey = receiveConnectField(connecting, connecting.publicKeySize)
+    if publicKey == nil then
+      return false
+    end
+
+    connecting.key = crypto.newAesKey()
+    local encryptedKey = crypto.rsaEncrypt(publicKey, connecting.key)
+    connecting.outgoing = util.encodeMessageSize(#encryptedKey) .. encryptedKey
+  end
+
+  if connecting.outgoing ~= nil then
+    local last, err, partial = connecting.sock:send(connecting.outgoing, connecting.outgoingOffset)
+    if last == nil then
+      if err ~= "timeout" then
+        error("client socket key exchange send error: " .. err)
+      end
+
+      connecting.outgoingOffset = partial + 1
+      return false
+    end
+
+    connecting.outgoing = nil
+  end
+
+  return true
+end
+
 ---Constructs and returns a new network client.
 ---@return Client
 function Client.new()
@@ -85,46 +451,159 @@ function Client.new()
     _isConnected = false,
     _sock = nil,
     _key = nil,
+    _routedKey = nil,
+    _udp = nil,
+    _udpToken = nil,
+    _udpKey = nil,
+    _udpSendSeq = 0,
+    _udpRecvSeq = 0,
+    _udpRegistered = false,
+    _udpRegisteredAt = 0,
+    _timers = timer.TimerWheel.new(),
+    _calls = {},
+    _callBytes = 0,
+    _nextCallId = 1,
+    _outbox = nil,
+    _inbox = nil,
+    _streamWeights = {},
+    _rawBuffer = crypto.newBuffer(),
+    _states = {},
+    _batch = nil,
+    _connecting = nil,
+    _readSize = nil,
+    _readPartial = "",
   }, Client)
 
   return client
 end
 
----Connects to a server.
+---Connects to a server. A host of the form `shm://name` connects to a server on the same machine through shared memory instead, in which case the port is ignored.
 ---@param host string The server host address.
----@param port integer The server port.
+---@param port integer? The server port.
 ---@return thread # A coroutine that must be polled to handle client events.
 function Client:connect(host, port)
   if self._isConnected then
     error("client is already connected to a server")
   end
 
-  local sock, err = socket.connect(host, port)
+  local shmName = shm.parseAddress(host)
+  local sock, err
+  if shmName ~= nil then
+    sock, err = shm.connect(shmName)
+  else
+    sock, err = socket.connect(host, port)
+  end
+
   if err ~= nil then
     error("client socket connect error: " .. err)
   end
 
   sock:setoption("reuseaddr", true)
   self._sock = sock
+  self._key = nil
   self._isConnected = true
-  exchangeKeys(self)
-  self._sock:settimeout(0)
 
-  local co = coroutine.create(function ()
-    handle(self)
-  end)
+  if shmName == nil or sock:encrypted() then
+    exchangeKeys(self)
+  end
 
-  return co
+  return start(self)
 end
 
----Disconnects from the server.
+---Begins connecting to a server without blocking, for a connection pool. The connection and key exchange are then advanced with `client:_continueConnect`, and can be abandoned with `client:disconnect`. Shared memory connections wait for the server to accept them before this returns, for at most `timeout` seconds.
+---@param host string The server host address.
+---@param port integer? The server port.
+---@param timeout number The number of seconds a shared memory connection may wait to be accepted.
+function Client:_beginConnect(host, port, timeout)
+  if self._isConnected or self._connecting ~= nil then
+    error("client is already connected to a server")
+  end
+
+  local shmName = shm.parseAddress(host)
+  local sock, err
+  local established = true
+  if shmName ~= nil then
+    sock, err = shm.connect(shmName, timeout)
+  else
+    sock = socket.tcp()
+    sock:settimeout(0)
+    err = select(2, sock:connect(host, port))
+
+    -- A connection that cannot be established immediately completes in the background
+    if err == "timeout" then
+      established = false
+      err = nil
+    end
+  end
+
+  if err ~= nil then
+    if sock ~= nil then
+      sock:close()
+    end
+
+    error("client socket connect error: " .. err)
+  end
+
+  sock:setoption("reuseaddr", true)
+  sock:settimeout(0)
+  self._connecting = {
+    sock = sock,
+    host = host,
+    port = port,
+    established = established,
+    exchangesKeys = shmName == nil or sock:encrypted(),
+    publicKeySize = nil,
+    received = "",
+    key = nil,
+    outgoing = nil,
+    outgoingOffset = 1,
+  }
+end
+
+---Advances a connection begun with `client:_beginConnect` as far as possible without blocking. If the connection fails, it is abandoned and an error is raised.
+---@return thread? # A coroutine that must be polled to handle client events, once the connection is open, or nil while it is still being opened.
+function Client:_continueConnect()
+  local connecting = self._connecting
+  if connecting == nil then
+    error("client is not connecting to a server")
+  end
+
+  local ok, result = pcall(progressConnect, connecting)
+  if not ok then
+    connecting.sock:close()
+    self._connecting = nil
+    error(result, 0)
+  end
+
+  if not result then
+    return nil
+  end
+
+  self._connecting = nil
+  self._sock = connecting.sock
+  self._key = connecting.key
+  self._isConnected = true
+
+  return start(self)
+end
+
+---Disconnects from the server, or abandons a connection begun with `client:_beginConnect`.
 function Client:disconnect()
+  if self._connecting ~= nil then
+    self._connecting.sock:close()
+    self._connecting = nil
+    return
+  end
+
   if not self._isConnected then
     error("client is not connected to a server")
   end
 
   self._isConnected = false
+  self._batch = nil
   self._sock:close()
+  closeDatagrams(self)
+  failCalls(self)
 end
 
 ---Sends data to the server.
@@ -135,17 +614,202 @@ function Client:send(data)
   end
 
   local dataSerialized = util.serialize(data)
-  local dataEncrypted = crypto.aesEncrypt(self._key, dataSerialized)
-  local size = util.encodeMessageSize(#dataEncrypted)
-  local buffer = size .. dataEncrypted
-  local n, err = self._sock:send(buffer)
-  if err ~= nil then
-    error("client socket send error: " .. err)
+
+  if self._batch ~= nil then
+    if self._batch:add(dataSerialized) then
+      sendFrame(self, self._batch:encode(self._key))
+    end
+
+    return
   end
 
-  if n ~= #buffer then
-    error("client socket did not send all bytes (" .. n .. "/" .. #buffer .. ")")
+  sendFrame(self, frame.encode(self._key, frame.kinds.data, dataSerialized))
+end
+
+---Starts batching messages. Until the batch is flushed, messages sent with `client:send` are held back and then sent together in a single encrypted frame, which saves the per-frame encryption, padding and system call overhead when sending many small messages. The server receives them as separate events, in order. Batches that grow large are sent early. Other kinds of messages are not batched, and may arrive before the batched ones.
+function Client:beginBatch()
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  if self._batch ~= nil then
+    error("client is already batching")
+  end
+
+  self._batch = batch.Batch.new()
+end
+
+---Sends the messages batched since `client:beginBatch`, and stops batching.
+function Client:flushBatch()
+  if self._batch == nil then
+    error("client is not batching")
+  end
+
+  local pending = self._batch
+  self._batch = nil
+
+  if not pending:empty() then
+    sendFrame(self, pending:encode(self._key))
+  end
+end
+
+---Batches the messages sent by a function, as with `client:beginBatch` and `client:flushBatch`. The batch is flushed even if the function raises an error.
+---@param fn function The function, which is called without arguments.
+function Client:batch(fn)
+  self:beginBatch()
+  local ok, err = pcall(fn)
+  self:flushBatch()
+
+  if not ok then
+    error(err, 0)
+  end
+end
+
+---Sends a frame whose payload has already been serialized. This is used to replay captured traffic.
+---@param kind integer The frame kind.
+---@param payload string The serialized frame payload.
+---@param header string? The frame header.
+function Client:_sendEncoded(kind, payload, header)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  local key = self._key
+  if kind == frame.kinds.routed then
+    key = self._routedKey
+  end
+
+  sendFrame(self, frame.encode(key, kind, payload, header))
+end
+
+---Sends raw bytes to the server, skipping serialization. The server receives them in a buffer, as an event of type "receiveRaw".
+---@param data string|Buffer The bytes to send.
+function Client:sendRaw(data)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  sendFrame(self, frame.encodeRaw(self._key, data, self._rawBuffer))
+end
+
+---Sends data to the server with a routing header. The header carries a message type and a routing key, which are sent unencrypted so that the server can route or drop the message without decrypting or deserializing it. The server receives the data as a message, in an event of type "receiveRouted".
+---@param messageType integer The message type, from 0 to 65535.
+---@param routingKey integer The routing key, from 0 to 4294967295.
+---@param data any The data to send.
+function Client:sendRouted(messageType, routingKey, data)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  local header = messageImpl.encodeHeader(messageType, routingKey)
+  sendFrame(self, frame.encode(self._routedKey, frame.kinds.routed, util.serialize(data), header))
+end
+
+---Queues data to be sent to the server on a logical stream. Stream messages are split into chunks that are interleaved with those of other streams as the client is polled, so a large message does not hold up smaller ones on other streams. Messages on the same stream arrive in order, as events of type "receive" carrying the stream ID. Messages sent with `client:send` bypass the queue entirely.
+---@param streamId integer The stream ID, from 0 to 65535.
+---@param data any The data to send.
+function Client:sendStream(streamId, data)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  stream.checkStreamId(streamId)
+  self._outbox:push(streamId, util.serialize(data))
+end
+
+---Sets the scheduling weight of an outgoing stream. When several streams have queued messages, each stream's share of the connection is proportional to its weight. Streams have a weight of 1 by default.
+---@param streamId integer The stream ID, from 0 to 65535.
+---@param weight number The weight, which must be positive.
+function Client:setStreamWeight(streamId, weight)
+  stream.checkStreamId(streamId)
+
+  if weight <= 0 then
+    error("stream weight must be positive")
+  end
+
+  self._streamWeights[streamId] = weight
+end
+
+---Calls a procedure registered on the server with `server:handle`. Calls do not block: any number of them can be in flight at once, and responses are matched to calls by correlation ID as the client is polled. A call fails if the server has no handler for the method, if the handler raises an error, if the timeout elapses, or if the client disconnects first.
+---@param method string The method name.
+---@param args any The arguments to pass to the handler.
+---@param timeout number? The number of seconds to wait for a response, or nil to wait indefinitely.
+---@return Call # The pending call.
+function Client:call(method, args, timeout)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  local id = self._nextCallId
+  self._nextCallId = id % rpc.maxCallId + 1
+
+  local call = rpc.Call.new()
+  self._calls[id] = call
+
+  local request = util.serialize({ method, args })
+  call._size = #request
+  self._callBytes = self._callBytes + call._size
+  sendFrame(self, frame.encode(self._key, frame.kinds.request, request, util.encodeInteger(id, rpc.callIdSize)))
+
+  if timeout ~= nil then
+    call._timer = self._timers:schedule(timeout, function ()
+      if self._calls[id] == call then
+        self._calls[id] = nil
+        self._callBytes = self._callBytes - call._size
+      end
+
+      call:_complete(false, "timeout")
+    end)
   end
+
+  return call
+end
+
+---Sends data to the server over the unreliable datagram channel. The message is delivered at most once, may be lost, and is dropped by the server if a newer message has already arrived. Messages sent before the server has opened the channel are dropped.
+---@param data any The data to send.
+---@return boolean # Whether the message was sent.
+function Client:sendUnreliable(data)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  if self._udp == nil then
+    return false
+  end
+
+  local dataSerialized = util.serialize(data)
+  self._udpSendSeq = self._udpSendSeq + 1
+  self._udp:send(datagram.seal(self._udpKey, self._udpToken, datagram.directions.toServer, self._udpSendSeq, dataSerialized))
+
+  return true
+end
+
+---Subscribes to a topic. Data the server publishes to the topic with `server:publish` arrives as events of type "receive" carrying the topic. Subscriptions last until the client unsubscribes or disconnects.
+---@param topic string The topic.
+function Client:subscribe(topic)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  sendFrame(self, frame.encode(self._key, frame.kinds.subscribe, util.serialize(topic)))
+end
+
+---Unsubscribes from a topic.
+---@param topic string The topic.
+function Client:unsubscribe(topic)
+  if not self._isConnected then
+    error("client is not connected to a server")
+  end
+
+  sendFrame(self, frame.encode(self._key, frame.kinds.unsubscribe, util.serialize(topic)))
+end
+
+---Returns the latest contents of a state published by the server with `server:publishState`. The same table is updated in place as changes arrive.
+---@param name string The state name.
+---@return table? # The state, or nil if it has not been received.
+function Client:getState(name)
+  local current = self._states[name]
+  return current and current.data
 end
 
 ---Is the client currently connected to a server?
@@ -154,6 +818,52 @@ function Client:connected()
   return self._isConnected
 end
 
+---Returns the number of bytes sent to the server that are still outstanding: stream data that has not been written yet, and the requests of calls awaiting a response. Frames sent with `send`, `sendRaw` and `sendRouted` are written immediately and never count.
+---@return integer
+function Client:outstandingBytes()
+  if not self._isConnected then
+    return 0
+  end
+
+  return self._outbox:pendingBytes() + self._callBytes
+end
+
+---Adds the sockets the client is waiting on to the sets passed to `socket.select`, for a reactor driving it.
+---@param recvt table The sockets to wait on for reading.
+---@param sendt table The sockets to wait on for writing.
+---@return number? # How long until the client must be polled regardless, or nil if it only needs polling once one of its sockets is ready.
+function Client:_watch(recvt, sendt)
+  local connecting = self._connecting
+  if connecting ~= nil then
+    if not connecting.established or connecting.outgoing ~= nil then
+      return reactor.watch(connecting.sock, sendt)
+    end
+
+    return reactor.watch(connecting.sock, recvt)
+  end
+
+  if not self._isConnected then
+    return 0
+  end
+
+  local delay = reactor.earliest(self._timers:nextDelay(), reactor.watch(self._sock, recvt))
+
+  if self._outbox:pending() then
+    delay = reactor.earliest(delay, reactor.watch(self._sock, sendt))
+  end
+
+  if self._udp ~= nil then
+    delay = reactor.earliest(delay, reactor.watch(self._udp, recvt))
+
+    if not self._udpRegistered then
+      local retry = self._udpRegisteredAt + registrationInterval - socket.gettime()
+      delay = reactor.earliest(delay, math.max(retry, 0))
+    end
+  end
+
+  return delay
+end
+
 ---Returns the client's address.
 ---@return string # The client's host address.
 ---@return integer # The client's port.
@@ -1,4 +1,10 @@
 local crypto = require("luadtp.cryptocore")
+---@module "src.cryptoffi"
+local cryptoffi = require("luadtp.cryptoffi")
+
+-- The AES functions, bound through the FFI when running under LuaJIT.
+local aes_encrypt = cryptoffi.aes_encrypt or crypto.aes_encrypt
+local aes_decrypt = cryptoffi.aes_decrypt or crypto.aes_decrypt
 
 ---Generates a new RSA key pair.
 ---@return string # The RSA public key.
@@ -58,7 +64,7 @@ end
 ---@param plaintext string The plaintext to encrypt.
 ---@return string # The encrypted ciphertext.
 local function aesEncrypt(key, plaintext)
-  local ciphertext = crypto.aes_encrypt(key, plaintext)
+  local ciphertext = aes_encrypt(key, plaintext)
 
   if ciphertext == nil then
     error("Failed AES encryption, OpenSSL error: " .. crypto.get_openssl_error())
@@ -72,7 +78,7 @@ end
 ---@param ciphertext string The ciphertext to decrypt.
 ---@return string # The decrypted plaintext.
 local function aesDecrypt(key, ciphertext)
-  local plaintext = crypto.aes_decrypt(key, ciphertext)
+  local plaintext = aes_decrypt(key, ciphertext)
 
   if plaintext == nil then
     error("Failed AES decryption, OpenSSL error: " .. crypto.get_openssl_error())
@@ -81,6 +87,108 @@ local function aesDecrypt(key, ciphertext)
   return plaintext
 end
 
+---Performs an authenticated AES-256-GCM encryption.
+---@param key string The AES key.
+---@param nonce string The 12 byte nonce. A nonce must never be reused with the same key.
+---@param aad string Additional data to authenticate without encrypting.
+---@param plaintext string The plaintext to encrypt.
+---@return string # The encrypted ciphertext, followed by the authentication tag.
+local function aeadEncrypt(key, nonce, aad, plaintext)
+  local ciphertext = crypto.aead_encrypt(key, nonce, aad, plaintext)
+
+  if ciphertext == nil then
+    error("Failed AEAD encryption, OpenSSL error: " .. crypto.get_openssl_error())
+  end
+
+  return ciphertext
+end
+
+---Performs an authenticated AES-256-GCM decryption.
+---@param key string The AES key.
+---@param nonce string The 12 byte nonce the ciphertext was encrypted with.
+---@param aad string The additional data the ciphertext was encrypted with.
+---@param ciphertext string The ciphertext to decrypt, followed by the authentication tag.
+---@return string? # The decrypted plaintext, or nil if the ciphertext could not be authenticated.
+local function aeadDecrypt(key, nonce, aad, ciphertext)
+  return crypto.aead_decrypt(key, nonce, aad, ciphertext)
+end
+
+---Computes an HMAC-SHA256 digest.
+---@param key string The HMAC key.
+---@param data string The data to authenticate.
+---@return string # The 32 byte digest.
+local function hmacSha256(key, data)
+  local digest = crypto.hmac_sha256(key, data)
+
+  if digest == nil then
+    error("Failed HMAC computation, OpenSSL error: " .. crypto.get_openssl_error())
+  end
+
+  return digest
+end
+
+---@class Buffer A mutable, resizable byte buffer. Buffers can be passed anywhere a payload is accepted, which avoids creating intermediate Lua strings for large binary data.
+---@field len fun(self: Buffer): integer Returns the number of bytes in the buffer.
+---@field capacity fun(self: Buffer): integer Returns the number of bytes the buffer can hold without reallocating.
+---@field append fun(self: Buffer, data: string|Buffer, i: integer?, j: integer?): Buffer Appends bytes, optionally only those from index `i` to `j` of the data.
+---@field write fun(self: Buffer, offset: integer, data: string|Buffer): Buffer Overwrites bytes starting at an index, growing the buffer if necessary.
+---@field resize fun(self: Buffer, size: integer): Buffer Truncates the buffer or grows it with zero bytes.
+---@field clear fun(self: Buffer): Buffer Empties the buffer, keeping its memory for reuse.
+---@field sub fun(self: Buffer, i: integer?, j: integer?): string Copies a range of bytes into a string, with the same indexing as `string.sub`.
+---@field slice fun(self: Buffer, i: integer?, j: integer?): Buffer Copies a range of bytes into a new buffer, with the same indexing as `string.sub`.
+---@field byte fun(self: Buffer, i: integer?): integer? Returns the byte at an index.
+
+---Constructs a new byte buffer.
+---@param init (integer|string|Buffer)? The number of bytes to allocate up front, or the initial contents.
+---@return Buffer
+local function newBuffer(init)
+  return crypto.buffer_new(init)
+end
+
+---Is a value a byte buffer?
+---@param value any The value.
+---@return boolean
+local function isBuffer(value)
+  return crypto.is_buffer(value)
+end
+
+---Performs an AES encryption, appending the ciphertext to a buffer.
+---@param key string The AES key.
+---@param plaintext string|Buffer The plaintext to encrypt.
+---@param out Buffer The buffer to append the ciphertext to.
+local function aesEncryptInto(key, plaintext, out)
+  if crypto.aes_encrypt_into(key, plaintext, out) == nil then
+    error("Failed AES encryption, OpenSSL error: " .. crypto.get_openssl_error())
+  end
+end
+
+---Performs an AES decryption, appending the plaintext to a buffer.
+---@param key string The AES key.
+---@param ciphertext string|Buffer The data containing the ciphertext.
+---@param offset integer The index at which the ciphertext starts.
+---@param out Buffer The buffer to append the plaintext to.
+local function aesDecryptInto(key, ciphertext, offset, out)
+  if crypto.aes_decrypt_into(key, ciphertext, offset, out) == nil then
+    error("Failed AES decryption, OpenSSL error: " .. crypto.get_openssl_error())
+  end
+end
+
+---Encodes a frame into a buffer in a single native call, encrypting its payload if a key is given. The buffer's previous contents are discarded.
+---@param key string? The AES key, or nil to leave the payload unencrypted.
+---@param kind integer The frame kind.
+---@param header string The frame header, which is sent unencrypted.
+---@param payload string|Buffer The frame payload.
+---@param out Buffer The buffer to encode the frame into.
+---@param sealed boolean? Whether to seal the payload with AES-256-GCM under a random nonce, authenticating the header along with it, instead of encrypting it with AES-256-CBC.
+---@return Buffer # The encoded frame, including its size prefix.
+local function encodeFrameInto(key, kind, header, payload, out, sealed)
+  if crypto.encode_frame_into(key, kind, header, payload, out, sealed) == nil then
+    error("Failed AES encryption, OpenSSL error: " .. crypto.get_openssl_error())
+  end
+
+  return out
+end
+
 ---Sleeps for a given duration of time.
 ---@param seconds number The number of seconds to sleep.
 local function sleep(seconds)
@@ -94,5 +202,13 @@ return {
   newAesKey = newAesKey,
   aesEncrypt = aesEncrypt,
   aesDecrypt = aesDecrypt,
+  aeadEncrypt = aeadEncrypt,
+  aeadDecrypt = aeadDecrypt,
+  hmacSha256 = hmacSha256,
+  newBuffer = newBuffer,
+  isBuffer = isBuffer,
+  aesEncryptInto = aesEncryptInto,
+  aesDecryptInto = aesDecryptInto,
+  encodeFrameInto = encodeFrameInto,
   sleep = sleep,
 }
@@ -0,0 +1,101 @@
+-- LuaJIT FFI bindings for the hot-path functions of the native crypto core. Calls through the Lua C API
+-- abort JIT traces, while FFI calls are compiled inline, keeping the send and receive loops compiled
+-- end to end. Under any other Lua implementation, or if the native library cannot be bound, this module
+-- is an empty table and callers fall back to the `luadtp.cryptocore` functions of the same names.
+
+local lenSize = 5
+
+local hasFfi, ffi = pcall(require, "ffi")
+if not hasFfi or jit == nil or package.searchpath == nil then
+  return {}
+end
+
+local path = package.searchpath("luadtp.cryptocore", package.cpath)
+if path == nil then
+  return {}
+end
+
+local declared = pcall(ffi.cdef, [[
+  size_t luadtp_aes_encrypted_size(size_t plaintext_size);
+  int luadtp_aes_encrypt(const char *key, size_t key_size, const char *plaintext, size_t plaintext_size, unsigned char *out);
+  int luadtp_aes_decrypt(const char *key, size_t key_size, const char *ciphertext, size_t ciphertext_size, unsigned char *out);
+  void luadtp_encode_message_size(size_t size, unsigned char *out);
+  size_t luadtp_decode_message_size(const char *encoded_size);
+]])
+if not declared then
+  return {}
+end
+
+local loaded, lib = pcall(ffi.load, path)
+if not loaded then
+  return {}
+end
+
+-- The output buffer shared by all calls. It only ever grows, so steady-state calls do not allocate.
+local scratch = nil
+local scratchSize = 0
+
+-- The output buffer for encoded message sizes.
+local sizeScratch = ffi.new("unsigned char[?]", lenSize)
+
+---Returns the shared output buffer, growing it to hold at least a given number of bytes.
+---@param size integer The number of bytes needed.
+---@return userdata # The buffer.
+local function reserve(size)
+  if size > scratchSize then
+    scratchSize = math.max(size, scratchSize * 2, 4096)
+    scratch = ffi.new("unsigned char[?]", scratchSize)
+  end
+
+  return scratch
+end
+
+---Performs an AES encryption.
+---@param key string The AES key.
+---@param plaintext string The plaintext to encrypt.
+---@return string? # The encrypted ciphertext, or nil on failure.
+local function aes_encrypt(key, plaintext)
+  local out = reserve(tonumber(lib.luadtp_aes_encrypted_size(#plaintext)))
+  local n = lib.luadtp_aes_encrypt(key, #key, plaintext, #plaintext, out)
+  if n < 0 then
+    return nil
+  end
+
+  return ffi.string(out, n)
+end
+
+---Performs an AES decryption.
+---@param key string The AES key.
+---@param ciphertext string The ciphertext to decrypt.
+---@return string? # The decrypted plaintext, or nil on failure.
+local function aes_decrypt(key, ciphertext)
+  local out = reserve(#ciphertext)
+  local n = lib.luadtp_aes_decrypt(key, #key, ciphertext, #ciphertext, out)
+  if n < 0 then
+    return nil
+  end
+
+  return ffi.string(out, n)
+end
+
+---Encodes the size portion of a message.
+---@param size integer The size of the message.
+---@return string # The encoded size.
+local function encode_message_size(size)
+  lib.luadtp_encode_message_size(size, sizeScratch)
+  return ffi.string(sizeScratch, lenSize)
+end
+
+---Decodes the size portion of a message.
+---@param encodedSize string The encoded message size.
+---@return integer # The decoded size.
+local function decode_message_size(encodedSize)
+  return tonumber(lib.luadtp_decode_message_size(encodedSize))
+end
+
+return {
+  aes_encrypt = aes_encrypt,
+  aes_decrypt = aes_decrypt,
+  encode_message_size = encode_message_size,
+  decode_message_size = decode_message_size,
+}
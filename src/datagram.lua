@@ -0,0 +1,106 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.crypto"
+local crypto = require("luadtp.crypto")
+
+-- The size of the token identifying which connection a datagram belongs to.
+local tokenSize = 8
+
+-- The size of a datagram sequence number.
+local sequenceSize = 8
+
+-- The size of a datagram header, which is authenticated but not encrypted.
+local headerSize = tokenSize + sequenceSize
+
+-- The size of the authentication tag following each datagram's ciphertext.
+local tagSize = 16
+
+-- The largest payload that fits in a single UDP datagram.
+local maxPayloadSize = 65507 - headerSize - tagSize
+
+-- The directions a datagram can travel in. These keep nonces distinct between the two peers, which share a key.
+local directions = {
+  toServer = 1,
+  toClient = 2,
+}
+
+---Generates a new random connection token.
+---@return string # The token.
+local function newToken()
+  return string.sub(crypto.newAesKey(), 1, tokenSize)
+end
+
+---Derives the datagram key from a connection's AES key, so that the two ciphers never share a key.
+---@param key string The connection's AES key.
+---@return string # The datagram key.
+local function deriveKey(key)
+  return crypto.hmacSha256(key, "luadtp datagram")
+end
+
+---Returns the token of a received datagram.
+---@param packet string The datagram.
+---@return string? # The token, or nil if the datagram is too short to be valid.
+local function token(packet)
+  if #packet < headerSize + tagSize then
+    return nil
+  end
+
+  return string.sub(packet, 1, tokenSize)
+end
+
+---Encrypts a payload into a datagram.
+---@param key string The datagram key.
+---@param connectionToken string The connection token.
+---@param direction integer The direction the datagram is travelling in.
+---@param seq integer The datagram sequence number, which must be greater than that of every datagram sent before it.
+---@param payload string The payload.
+---@return string # The datagram.
+local function seal(key, connectionToken, direction, seq, payload)
+  if #payload > maxPayloadSize then
+    error("unreliable message too large (" .. #payload .. "/" .. maxPayloadSize .. " bytes)")
+  end
+
+  local encodedSeq = util.encodeInteger(seq, sequenceSize)
+  local header = connectionToken .. encodedSeq
+  local nonce = string.char(direction, 0, 0, 0) .. encodedSeq
+
+  return header .. crypto.aeadEncrypt(key, nonce, header, payload)
+end
+
+---Authenticates and decrypts a received datagram. Datagrams that are no newer than the last accepted one are dropped without being decrypted, which filters out both replays and stale data.
+---@param key string The datagram key.
+---@param packet string The datagram.
+---@param direction integer The direction the datagram is expected to be travelling in.
+---@param lastSeq integer The sequence number of the last accepted datagram.
+---@return integer? # The datagram sequence number, or nil if the datagram was dropped.
+---@return string? # The payload.
+local function open(key, packet, direction, lastSeq)
+  if #packet < headerSize + tagSize then
+    return nil, nil
+  end
+
+  local encodedSeq = string.sub(packet, tokenSize + 1, headerSize)
+  local seq = util.decodeInteger(encodedSeq, 1, sequenceSize)
+  if seq <= lastSeq then
+    return nil, nil
+  end
+
+  local header = string.sub(packet, 1, headerSize)
+  local nonce = string.char(direction, 0, 0, 0) .. encodedSeq
+  local payload = crypto.aeadDecrypt(key, nonce, header, string.sub(packet, headerSize + 1))
+  if payload == nil then
+    return nil, nil
+  end
+
+  return seq, payload
+end
+
+return {
+  directions = directions,
+  maxPayloadSize = maxPayloadSize,
+  newToken = newToken,
+  deriveKey = deriveKey,
+  token = token,
+  seal = seal,
+  open = open,
+}
@@ -0,0 +1,134 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.crypto"
+local crypto = require("luadtp.crypto")
+
+---The kinds of frames exchanged once a connection has been established.
+local kinds = {
+  data = 0,
+  ping = 1,
+  pong = 2,
+  udpBind = 3,
+  request = 4,
+  response = 5,
+  chunk = 6,
+  raw = 7,
+  state = 8,
+  stateResync = 9,
+  subscribe = 10,
+  unsubscribe = 11,
+  publish = 12,
+  routed = 13,
+  batch = 14,
+}
+
+-- The size of the random nonce at the start of a sealed payload.
+local nonceSize = 12
+
+---The sizes of the unencrypted headers that precede the payload of some kinds of frames.
+local headerSizes = {
+  [kinds.request] = 4,
+  [kinds.response] = 4,
+  [kinds.chunk] = 3,
+  [kinds.routed] = 6,
+}
+
+---Encodes a frame, encrypting its payload if one is given. The payload of a routed frame is sealed with AES-256-GCM instead, so that its header is authenticated along with it.
+---@param key string? The AES key, or nil to leave the payload unencrypted.
+---@param kind integer The frame kind.
+---@param payload string? The frame payload.
+---@param header string? The frame header, which is sent unencrypted. Its size must match the kind's header size.
+---@return string # The encoded frame, including its size prefix.
+local function encode(key, kind, payload, header)
+  header = header or ""
+
+  if payload == nil then
+    payload = ""
+  elseif key ~= nil and kind == kinds.routed then
+    local nonce = string.sub(crypto.newAesKey(), 1, nonceSize)
+    payload = nonce .. crypto.aeadEncrypt(key, nonce, header, payload)
+  elseif key ~= nil then
+    payload = crypto.aesEncrypt(key, payload)
+  end
+
+  return util.encodeMessageSize(#header + #payload + 1) .. string.char(kind) .. header .. payload
+end
+
+---Encodes a frame into a buffer, encrypting or sealing its payload like `encode` if a key is given. Unlike `encode`, no intermediate Lua strings are created, so relaying a payload that is already in a buffer happens entirely in native code.
+---@param key string? The AES key, or nil to leave the payload unencrypted.
+---@param kind integer The frame kind.
+---@param payload string|Buffer The frame payload.
+---@param header string? The frame header, which is sent unencrypted. Its size must match the kind's header size.
+---@param out Buffer The buffer to encode the frame into. Its previous contents are discarded.
+---@return Buffer # The encoded frame, including its size prefix.
+local function encodeInto(key, kind, payload, header, out)
+  return crypto.encodeFrameInto(key, kind, header or "", payload, out, kind == kinds.routed)
+end
+
+---Encodes a raw frame, whose payload is sent as is rather than serialized, into a buffer.
+---@param key string? The AES key, or nil to leave the payload unencrypted.
+---@param payload string|Buffer The frame payload.
+---@param out Buffer The buffer to encode the frame into. Its previous contents are discarded.
+---@return Buffer # The encoded frame, including its size prefix.
+local function encodeRaw(key, payload, out)
+  return encodeInto(key, kinds.raw, payload, nil, out)
+end
+
+---Decodes the body of a received frame, decrypting its payload if it has one. The payload of a raw frame is returned in a new buffer. The payload of a routed frame is returned as received, so that it is only authenticated and decrypted if the message is opened, with `openSealed`.
+---@param key string? The AES key, or nil if the payload is unencrypted.
+---@param body string The frame body, excluding the size prefix.
+---@return integer? # The frame kind, or nil if the body is too short to hold the kind's header.
+---@return string|Buffer # The frame payload.
+---@return string # The frame header, which is empty for kinds without one.
+local function decode(key, body)
+  local kind = string.byte(body, 1)
+  local headerSize = headerSizes[kind] or 0
+
+  if kind == nil or #body < headerSize + 1 then
+    return nil, "", ""
+  end
+
+  if kind == kinds.raw then
+    local payload = crypto.newBuffer(#body)
+
+    if key ~= nil then
+      crypto.aesDecryptInto(key, body, 2, payload)
+    else
+      payload:append(body, 2)
+    end
+
+    return kind, payload, ""
+  end
+
+  local header = string.sub(body, 2, headerSize + 1)
+  local payload = string.sub(body, headerSize + 2)
+
+  if key ~= nil and #payload > 0 and kind ~= kinds.routed then
+    payload = crypto.aesDecrypt(key, payload)
+  end
+
+  return kind, payload, header
+end
+
+---Authenticates and decrypts the sealed payload of a routed frame.
+---@param key string The AES key.
+---@param header string The frame header, which was authenticated along with the payload.
+---@param payload string The payload as received.
+---@return string? # The plaintext, or nil if the payload could not be authenticated.
+local function openSealed(key, header, payload)
+  if #payload < nonceSize then
+    return nil
+  end
+
+  return crypto.aeadDecrypt(key, string.sub(payload, 1, nonceSize), header, string.sub(payload, nonceSize + 1))
+end
+
+return {
+  kinds = kinds,
+  headerSizes = headerSizes,
+  encode = encode,
+  encodeInto = encodeInto,
+  encodeRaw = encodeRaw,
+  decode = decode,
+  openSealed = openSealed,
+}
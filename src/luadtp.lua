@@ -2,6 +2,10 @@
 local clientImpl = require("luadtp.client")
 ---@module "src.server"
 local serverImpl = require("luadtp.server")
+---@module "src.reactor"
+local reactorImpl = require("luadtp.reactor")
+---@module "src.pool"
+local poolImpl = require("luadtp.pool")
 
 ---Constructs and returns a new network client.
 ---@return Client
@@ -15,7 +19,23 @@ local function server()
   return serverImpl.Server:new()
 end
 
+---Constructs and returns a new reactor, which drives many clients and servers from a single event loop.
+---@return Reactor
+local function reactor()
+  return reactorImpl.Reactor:new()
+end
+
+---Constructs and returns a new connection pool, which keeps several connections to a set of servers open and spreads messages over them.
+---@param endpoints PoolEndpoint[] The endpoints to connect to, each with a `host` and a `port`.
+---@param options PoolOptions? The pool options.
+---@return Pool
+local function pool(endpoints, options)
+  return poolImpl.Pool.new(endpoints, options)
+end
+
 return {
   client = client,
   server = server,
+  reactor = reactor,
+  pool = pool,
 }
@@ -19,8 +19,12 @@
 #define EVP_CIPHER_CTX void
 #define EVP_CIPHER void
 #define ENGINE void
+#define EVP_MD void
 
 #define BIO_CTRL_PENDING 10
+#define EVP_CTRL_GCM_SET_IVLEN 0x9
+#define EVP_CTRL_GCM_GET_TAG 0x10
+#define EVP_CTRL_GCM_SET_TAG 0x11
 
 extern BIO *BIO_new(const BIO_METHOD *type);
 extern BIO *BIO_new_mem_buf(const void *buf, int len);
@@ -68,6 +72,12 @@ extern int EVP_DecryptUpdate(EVP_CIPHER_CTX *ctx, unsigned char *out, int *outl,
                              const unsigned char *in, int inl);
 extern int EVP_DecryptFinal_ex(EVP_CIPHER_CTX *ctx, unsigned char *outm,
                                int *outl);
+extern const EVP_CIPHER *EVP_aes_256_gcm(void);
+extern int EVP_CIPHER_CTX_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr);
+extern const EVP_MD *EVP_sha256(void);
+extern unsigned char *HMAC(const EVP_MD *evp_md, const void *key, int key_len,
+                           const unsigned char *data, size_t data_len,
+                           unsigned char *md, unsigned int *md_len);
 extern int RAND_bytes(unsigned char *buf, int num);
 extern unsigned long ERR_get_error(void);
 
@@ -92,6 +102,15 @@ extern unsigned long ERR_get_error(void);
 // The AES nonce size.
 #define AES_NONCE_SIZE 16
 
+// The AEAD nonce size.
+#define AEAD_NONCE_SIZE 12
+
+// The AEAD authentication tag size.
+#define AEAD_TAG_SIZE 16
+
+// The HMAC-SHA256 digest size.
+#define HMAC_SHA256_SIZE 32
+
 /**
  * Generic data to be encrypted/decrypted.
  */
@@ -224,14 +243,14 @@ void pad_data(crypto_data_t *crypto_data)
         padded_data = malloc(crypto_data->data_size + 2);
         padded_data[0] = (char)1;
         padded_data[1] = (char)255;
-        memcpy(padded_data + 2, crypto_data->data, crypto_data->data_size + 2);
+        memcpy(padded_data + 2, crypto_data->data, crypto_data->data_size);
         crypto_data->data_size += 2;
     }
     else
     {
         padded_data = malloc(crypto_data->data_size + 1);
         padded_data[0] = (char)0;
-        memcpy(padded_data + 1, crypto_data->data, crypto_data->data_size + 1);
+        memcpy(padded_data + 1, crypto_data->data, crypto_data->data_size);
         crypto_data->data_size += 1;
     }
 
@@ -861,191 +880,1144 @@ crypto_data_t *aes_decrypt(aes_key_t *key, void *ciphertext, size_t ciphertext_s
 }
 
 /**
- * Gets the most recent OpenSSL error.
+ * Encrypt and authenticate data with AES-256-GCM.
  *
- * @return The error code.
+ * @param key The AES key.
+ * @param nonce The nonce, which must be AEAD_NONCE_SIZE bytes and must never be reused with the same key.
+ * @param aad Additional data that is authenticated but not encrypted.
+ * @param aad_size The size of the additional data, in bytes.
+ * @param plaintext The data to encrypt.
+ * @param plaintext_size The size of the data, in bytes.
+ * @return A representation of the encrypted data, followed by the authentication tag.
  */
-unsigned long get_openssl_error(void)
+crypto_data_t *aead_encrypt(aes_key_t *key, unsigned char *nonce, void *aad, size_t aad_size, void *plaintext, size_t plaintext_size)
 {
-    return ERR_get_error();
-}
+    EVP_CIPHER_CTX *ctx;
+    int len;
+    int ciphertext_len;
 
-static int l_encode_message_size(lua_State *L)
-{
-    size_t size = luaL_checkinteger(L, 1);
-    unsigned char *encoded_size = encode_message_size(size);
-    lua_pushlstring(L, (const char *)encoded_size, LENSIZE);
-    free(encoded_size);
-    return 1;
-}
+    if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+    {
+        return NULL;
+    }
 
-static int l_decode_message_size(lua_State *L)
-{
-    size_t encoded_size_len;
-    unsigned char *encoded_size = (unsigned char *)luaL_checklstring(L, 1, &encoded_size_len);
-    size_t decoded_size = decode_message_size(encoded_size);
-    lua_pushinteger(L, decoded_size);
-    return 1;
-}
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 0 ||
+        EVP_EncryptInit_ex(ctx, NULL, NULL, (unsigned char *)key->key, nonce) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
 
-static int l_rsa_key_pair_new(lua_State *L)
-{
-    rsa_key_pair_t *key_pair = rsa_key_pair_new();
+    if (aad_size > 0 && EVP_EncryptUpdate(ctx, NULL, &len, (unsigned char *)aad, (int)aad_size) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
 
-    if (key_pair == NULL)
+    unsigned char *ciphertext_unsigned = (unsigned char *)malloc((plaintext_size + AEAD_TAG_SIZE) * sizeof(unsigned char));
+
+    if (EVP_EncryptUpdate(ctx, ciphertext_unsigned, &len, (unsigned char *)plaintext, (int)plaintext_size) == 0)
     {
-        lua_pushnil(L);
-        lua_pushnil(L);
+        EVP_CIPHER_CTX_free(ctx);
+        free(ciphertext_unsigned);
+        return NULL;
     }
-    else
+
+    ciphertext_len = len;
+
+    if (EVP_EncryptFinal_ex(ctx, ciphertext_unsigned + len, &len) == 0)
     {
-        lua_pushlstring(L, (const char *)(key_pair->public_key->key), key_pair->public_key->key_size);
-        lua_pushlstring(L, (const char *)(key_pair->private_key->key), key_pair->private_key->key_size);
-        rsa_key_pair_free(key_pair);
+        EVP_CIPHER_CTX_free(ctx);
+        free(ciphertext_unsigned);
+        return NULL;
     }
 
-    return 2;
+    ciphertext_len += len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_SIZE, ciphertext_unsigned + ciphertext_len) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        free(ciphertext_unsigned);
+        return NULL;
+    }
+
+    crypto_data_t *ciphertext = crypto_data_new((void *)ciphertext_unsigned, ciphertext_len + AEAD_TAG_SIZE);
+
+    EVP_CIPHER_CTX_free(ctx);
+    free(ciphertext_unsigned);
+
+    return ciphertext;
 }
 
-static int l_rsa_encrypt(lua_State *L)
+/**
+ * Verify and decrypt data encrypted with AES-256-GCM.
+ *
+ * @param key The AES key.
+ * @param nonce The nonce the data was encrypted with.
+ * @param aad The additional data the data was encrypted with.
+ * @param aad_size The size of the additional data, in bytes.
+ * @param ciphertext The encrypted data, followed by the authentication tag.
+ * @param ciphertext_size The size of the encrypted data and tag, in bytes.
+ * @return A representation of the decrypted data, or NULL if the data could not be authenticated.
+ */
+crypto_data_t *aead_decrypt(aes_key_t *key, unsigned char *nonce, void *aad, size_t aad_size, void *ciphertext, size_t ciphertext_size)
 {
-    rsa_public_key_t public_key;
-    public_key.key = (char *)luaL_checklstring(L, 1, &(public_key.key_size));
-    size_t plaintext_size;
-    void *plaintext = (void *)luaL_checklstring(L, 2, &plaintext_size);
-    crypto_data_t *ciphertext = rsa_encrypt(&public_key, plaintext, plaintext_size);
+    if (ciphertext_size < AEAD_TAG_SIZE)
+    {
+        return NULL;
+    }
 
-    if (ciphertext == NULL)
+    int ciphertext_len = (int)(ciphertext_size - AEAD_TAG_SIZE);
+    unsigned char tag[AEAD_TAG_SIZE];
+    memcpy(tag, ((unsigned char *)ciphertext) + ciphertext_len, AEAD_TAG_SIZE);
+
+    EVP_CIPHER_CTX *ctx;
+    int len;
+    int plaintext_len;
+
+    if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
     {
-        lua_pushnil(L);
+        return NULL;
     }
-    else
+
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 0 ||
+        EVP_DecryptInit_ex(ctx, NULL, NULL, (unsigned char *)key->key, nonce) == 0)
     {
-        lua_pushlstring(L, (const char *)(ciphertext->data), ciphertext->data_size);
-        crypto_data_free(ciphertext);
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
     }
 
-    return 1;
-}
+    if (aad_size > 0 && EVP_DecryptUpdate(ctx, NULL, &len, (unsigned char *)aad, (int)aad_size) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
 
-static int l_rsa_decrypt(lua_State *L)
-{
-    rsa_private_key_t private_key;
-    private_key.key = (char *)luaL_checklstring(L, 1, &(private_key.key_size));
-    size_t ciphertext_size;
-    void *ciphertext = (void *)luaL_checklstring(L, 2, &ciphertext_size);
-    crypto_data_t *plaintext = rsa_decrypt(&private_key, ciphertext, ciphertext_size);
+    unsigned char *plaintext_unsigned = (unsigned char *)malloc((ciphertext_len + 1) * sizeof(unsigned char));
 
-    if (plaintext == NULL)
+    if (EVP_DecryptUpdate(ctx, plaintext_unsigned, &len, (unsigned char *)ciphertext, ciphertext_len) == 0)
     {
-        lua_pushnil(L);
+        EVP_CIPHER_CTX_free(ctx);
+        free(plaintext_unsigned);
+        return NULL;
     }
-    else
+
+    plaintext_len = len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_SIZE, tag) == 0 ||
+        EVP_DecryptFinal_ex(ctx, plaintext_unsigned + len, &len) <= 0)
     {
-        lua_pushlstring(L, (const char *)(plaintext->data), plaintext->data_size);
-        crypto_data_free(plaintext);
+        EVP_CIPHER_CTX_free(ctx);
+        free(plaintext_unsigned);
+        return NULL;
     }
 
-    return 1;
+    plaintext_len += len;
+    crypto_data_t *plaintext = crypto_data_new((void *)plaintext_unsigned, plaintext_len);
+
+    EVP_CIPHER_CTX_free(ctx);
+    free(plaintext_unsigned);
+
+    return plaintext;
 }
 
-static int l_aes_key_new(lua_State *L)
+/**
+ * Seal data with AES-256-GCM into a caller-provided buffer, under a random nonce that is written ahead of the ciphertext.
+ *
+ * @param key The AES key.
+ * @param key_size The size of the key, in bytes.
+ * @param aad Additional data that is authenticated but not encrypted.
+ * @param aad_size The size of the additional data, in bytes.
+ * @param plaintext The data to encrypt.
+ * @param plaintext_size The size of the data, in bytes.
+ * @param out Where to write the nonce, ciphertext and authentication tag, which must have room for `AEAD_NONCE_SIZE + plaintext_size + AEAD_TAG_SIZE` bytes.
+ * @return The number of bytes written, or -1 on failure.
+ */
+static int aead_seal_into(const char *key, size_t key_size, const char *aad, size_t aad_size, const char *plaintext, size_t plaintext_size, unsigned char *out)
 {
-    aes_key_t *key = aes_key_new();
+    EVP_CIPHER_CTX *ctx;
+    int len;
+    int ciphertext_len;
 
-    if (key == NULL)
+    if (key_size != AES_KEY_SIZE)
     {
-        lua_pushnil(L);
+        return -1;
     }
-    else
+
+    if (RAND_bytes(out, AEAD_NONCE_SIZE) == 0)
     {
-        lua_pushlstring(L, (const char *)(key->key), key->key_size);
-        aes_key_free(key);
+        return -1;
     }
 
-    return 1;
-}
+    if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+    {
+        return -1;
+    }
 
-static int l_aes_encrypt(lua_State *L)
-{
-    aes_key_t key;
-    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
-    size_t plaintext_size;
-    void *plaintext = (void *)luaL_checklstring(L, 2, &plaintext_size);
-    crypto_data_t *ciphertext = aes_encrypt(&key, plaintext, plaintext_size);
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) == 0 ||
+        EVP_EncryptInit_ex(ctx, NULL, NULL, (const unsigned char *)key, out) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
 
-    if (ciphertext == NULL)
+    if (aad_size > 0 && EVP_EncryptUpdate(ctx, NULL, &len, (const unsigned char *)aad, (int)aad_size) == 0)
     {
-        lua_pushnil(L);
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
     }
-    else
+
+    if (EVP_EncryptUpdate(ctx, out + AEAD_NONCE_SIZE, &len, (const unsigned char *)plaintext, (int)plaintext_size) == 0)
     {
-        lua_pushlstring(L, (const char *)(ciphertext->data), ciphertext->data_size);
-        crypto_data_free(ciphertext);
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
     }
 
-    return 1;
-}
+    ciphertext_len = len;
 
-static int l_aes_decrypt(lua_State *L)
-{
-    aes_key_t key;
-    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
-    size_t ciphertext_size;
-    void *ciphertext = (void *)luaL_checklstring(L, 2, &ciphertext_size);
-    crypto_data_t *plaintext = aes_decrypt(&key, ciphertext, ciphertext_size);
+    if (EVP_EncryptFinal_ex(ctx, out + AEAD_NONCE_SIZE + ciphertext_len, &len) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
 
-    if (plaintext == NULL)
+    ciphertext_len += len;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_SIZE, out + AEAD_NONCE_SIZE + ciphertext_len) == 0)
     {
-        lua_pushnil(L);
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
     }
-    else
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return AEAD_NONCE_SIZE + ciphertext_len + AEAD_TAG_SIZE;
+}
+
+/**
+ * Compute an HMAC-SHA256 digest.
+ *
+ * @param key The HMAC key.
+ * @param key_size The size of the key, in bytes.
+ * @param data The data to authenticate.
+ * @param data_size The size of the data, in bytes.
+ * @param digest Where to write the HMAC_SHA256_SIZE byte digest.
+ * @return 1 on success, 0 on failure.
+ */
+int hmac_sha256(void *key, size_t key_size, void *data, size_t data_size, unsigned char *digest)
+{
+    unsigned int digest_len = HMAC_SHA256_SIZE;
+
+    if (HMAC(EVP_sha256(), key, (int)key_size, (unsigned char *)data, data_size, digest, &digest_len) == NULL)
     {
-        lua_pushlstring(L, (const char *)(plaintext->data), plaintext->data_size);
-        crypto_data_free(plaintext);
+        return 0;
     }
 
     return 1;
 }
 
-static int l_get_openssl_error(lua_State *L)
+/**
+ * Get the largest size of the ciphertext produced by `luadtp_aes_encrypt`.
+ *
+ * @param plaintext_size The size of the plaintext, in bytes.
+ * @return The largest ciphertext size, in bytes.
+ */
+LUADTPCRYPTOCORE_API size_t luadtp_aes_encrypted_size(size_t plaintext_size)
 {
-    unsigned long err = get_openssl_error();
-    lua_pushinteger(L, err);
-    return 1;
+    // The nonce, the padding prefix and up to one block of cipher padding
+    return AES_NONCE_SIZE + plaintext_size + 2 + 16;
 }
 
-static int l_sleep(lua_State *L)
+/**
+ * Encrypt data with AES into a caller-provided buffer. The output is identical in format to that of `aes_encrypt`.
+ *
+ * @param key The AES key.
+ * @param key_size The size of the key, in bytes.
+ * @param plaintext The data to encrypt.
+ * @param plaintext_size The size of the data, in bytes.
+ * @param out Where to write the ciphertext, which must have room for `luadtp_aes_encrypted_size(plaintext_size)` bytes.
+ * @return The size of the ciphertext, in bytes, or -1 on failure.
+ */
+LUADTPCRYPTOCORE_API int luadtp_aes_encrypt(const char *key, size_t key_size, const char *plaintext, size_t plaintext_size, unsigned char *out)
 {
-    double seconds = luaL_checknumber(L, 1);
+    unsigned char prefix[2] = {0, 255};
+    int prefix_len = 1;
+    EVP_CIPHER_CTX *ctx;
+    int len;
+    int ciphertext_len;
 
-#ifdef _WIN32
-    Sleep(seconds * 1000);
-#else
-    struct timespec ts;
-    ts.tv_sec = seconds;
-    ts.tv_nsec = ((int)(seconds * 1000) % 1000) * 1000000;
-    nanosleep(&ts, NULL);
-#endif
+    if (key_size != AES_KEY_SIZE)
+    {
+        return -1;
+    }
 
-    return 0;
-}
+    if ((plaintext_size + 1) % 16 == 0)
+    {
+        prefix[0] = 1;
+        prefix_len = 2;
+    }
 
-static const struct luaL_Reg luadtpcryptocorelib[] = {
-    {"encode_message_size", l_encode_message_size},
-    {"decode_message_size", l_decode_message_size},
-    {"rsa_key_pair_new", l_rsa_key_pair_new},
-    {"rsa_encrypt", l_rsa_encrypt},
-    {"rsa_decrypt", l_rsa_decrypt},
-    {"aes_key_new", l_aes_key_new},
-    {"aes_encrypt", l_aes_encrypt},
-    {"aes_decrypt", l_aes_decrypt},
-    {"get_openssl_error", l_get_openssl_error},
-    {"sleep", l_sleep},
-    {NULL, NULL}};
+    if (RAND_bytes(out, AES_NONCE_SIZE) == 0)
+    {
+        return -1;
+    }
+
+    if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+    {
+        return -1;
+    }
+
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, (const unsigned char *)key, out) == 0 ||
+        EVP_EncryptUpdate(ctx, out + AES_NONCE_SIZE, &len, prefix, prefix_len) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    ciphertext_len = len;
+
+    if (EVP_EncryptUpdate(ctx, out + AES_NONCE_SIZE + ciphertext_len, &len, (const unsigned char *)plaintext, (int)plaintext_size) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    ciphertext_len += len;
+
+    if (EVP_EncryptFinal_ex(ctx, out + AES_NONCE_SIZE + ciphertext_len, &len) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    ciphertext_len += len;
+    EVP_CIPHER_CTX_free(ctx);
+
+    return AES_NONCE_SIZE + ciphertext_len;
+}
+
+/**
+ * Decrypt data produced by `aes_encrypt` or `luadtp_aes_encrypt` into a caller-provided buffer.
+ *
+ * @param key The AES key.
+ * @param key_size The size of the key, in bytes.
+ * @param ciphertext The data to decrypt.
+ * @param ciphertext_size The size of the data, in bytes.
+ * @param out Where to write the plaintext, which must have room for `ciphertext_size` bytes.
+ * @return The size of the plaintext, in bytes, or -1 on failure.
+ */
+LUADTPCRYPTOCORE_API int luadtp_aes_decrypt(const char *key, size_t key_size, const char *ciphertext, size_t ciphertext_size, unsigned char *out)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len;
+    int plaintext_len;
+    int prefix_len;
+
+    if (key_size != AES_KEY_SIZE || ciphertext_size <= AES_NONCE_SIZE)
+    {
+        return -1;
+    }
+
+    if ((ctx = EVP_CIPHER_CTX_new()) == NULL)
+    {
+        return -1;
+    }
+
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, (const unsigned char *)key, (const unsigned char *)ciphertext) == 0 ||
+        EVP_DecryptUpdate(ctx, out, &len, (const unsigned char *)ciphertext + AES_NONCE_SIZE, (int)(ciphertext_size - AES_NONCE_SIZE)) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    plaintext_len = len;
+
+    if (EVP_DecryptFinal_ex(ctx, out + plaintext_len, &len) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    plaintext_len += len;
+    EVP_CIPHER_CTX_free(ctx);
+
+    if (plaintext_len < 1)
+    {
+        return -1;
+    }
+
+    prefix_len = out[0] == 1 ? 2 : 1;
+
+    if (plaintext_len < prefix_len)
+    {
+        return -1;
+    }
+
+    memmove(out, out + prefix_len, (size_t)(plaintext_len - prefix_len));
+
+    return plaintext_len - prefix_len;
+}
+
+/**
+ * Encode a message size into a caller-provided buffer.
+ *
+ * @param size The message size.
+ * @param out Where to write the LENSIZE byte encoded size.
+ */
+LUADTPCRYPTOCORE_API void luadtp_encode_message_size(size_t size, unsigned char *out)
+{
+    for (int i = LENSIZE - 1; i >= 0; i--)
+    {
+        out[i] = size & 0xff;
+        size = size >> 8;
+    }
+}
+
+/**
+ * Decode a message size.
+ *
+ * @param encoded_size The LENSIZE byte encoded size.
+ * @return The message size.
+ */
+LUADTPCRYPTOCORE_API size_t luadtp_decode_message_size(const char *encoded_size)
+{
+    return decode_message_size((unsigned char *)encoded_size);
+}
+
+/**
+ * Gets the most recent OpenSSL error.
+ *
+ * @return The error code.
+ */
+unsigned long get_openssl_error(void)
+{
+    return ERR_get_error();
+}
+
+/**
+ * Ensure a buffer has room for a given number of bytes, growing it geometrically.
+ *
+ * @param buffer The buffer.
+ * @param capacity The number of bytes needed.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int buffer_reserve(luadtp_buffer_t *buffer, size_t capacity)
+{
+    if (capacity <= buffer->capacity)
+    {
+        return 1;
+    }
+
+    size_t new_capacity = buffer->capacity * 2;
+
+    if (new_capacity < capacity)
+    {
+        new_capacity = capacity;
+    }
+
+    unsigned char *data = (unsigned char *)realloc(buffer->data, new_capacity);
+
+    if (data == NULL)
+    {
+        return 0;
+    }
+
+    buffer->data = data;
+    buffer->capacity = new_capacity;
+
+    return 1;
+}
+
+/**
+ * Append bytes to a buffer.
+ *
+ * @param buffer The buffer.
+ * @param data The bytes to append.
+ * @param data_size The number of bytes to append.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int buffer_append(luadtp_buffer_t *buffer, const void *data, size_t data_size)
+{
+    if (buffer_reserve(buffer, buffer->size + data_size) == 0)
+    {
+        return 0;
+    }
+
+    if (data_size > 0)
+    {
+        memmove(buffer->data + buffer->size, data, data_size);
+    }
+
+    buffer->size += data_size;
+
+    return 1;
+}
+
+static luadtp_buffer_t *check_buffer(lua_State *L, int arg)
+{
+    return (luadtp_buffer_t *)luaL_checkudata(L, arg, LUADTP_BUFFER_METATABLE);
+}
+
+/**
+ * Get the bytes of an argument that is either a string or a buffer.
+ *
+ * @param L The Lua state.
+ * @param arg The argument index.
+ * @param size Where to write the number of bytes.
+ * @return The bytes.
+ */
+static const char *check_bytes(lua_State *L, int arg, size_t *size)
+{
+    luadtp_buffer_t *buffer = (luadtp_buffer_t *)luaL_testudata(L, arg, LUADTP_BUFFER_METATABLE);
+
+    if (buffer != NULL)
+    {
+        *size = buffer->size;
+        return (const char *)buffer->data;
+    }
+
+    return luaL_checklstring(L, arg, size);
+}
+
+/**
+ * Resolve an optional range of 1-based, inclusive indices the way `string.sub` does, where negative indices count from the end.
+ *
+ * @param L The Lua state.
+ * @param arg The index of the argument holding the start of the range. The end is the following argument.
+ * @param size The size of the indexed data.
+ * @param start Where to write the 0-based start offset.
+ * @return The number of bytes in the range.
+ */
+static size_t check_range(lua_State *L, int arg, size_t size, size_t *start)
+{
+    lua_Integer i = luaL_optinteger(L, arg, 1);
+    lua_Integer j = luaL_optinteger(L, arg + 1, -1);
+
+    if (i < 0)
+    {
+        i = (lua_Integer)size + i + 1;
+    }
+
+    if (j < 0)
+    {
+        j = (lua_Integer)size + j + 1;
+    }
+
+    if (i < 1)
+    {
+        i = 1;
+    }
+
+    if (j > (lua_Integer)size)
+    {
+        j = (lua_Integer)size;
+    }
+
+    *start = (size_t)(i - 1);
+
+    return i > j ? 0 : (size_t)(j - i + 1);
+}
+
+/**
+ * Push a new, empty buffer.
+ *
+ * @param L The Lua state.
+ * @param capacity The number of bytes to allocate up front.
+ * @return The buffer.
+ */
+static luadtp_buffer_t *push_buffer(lua_State *L, size_t capacity)
+{
+    luadtp_buffer_t *buffer = (luadtp_buffer_t *)lua_newuserdata(L, sizeof(luadtp_buffer_t));
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+    luaL_setmetatable(L, LUADTP_BUFFER_METATABLE);
+
+    if (buffer_reserve(buffer, capacity) == 0)
+    {
+        luaL_error(L, "buffer allocation failed");
+    }
+
+    return buffer;
+}
+
+static int l_buffer_new(lua_State *L)
+{
+    if (lua_type(L, 1) == LUA_TNUMBER)
+    {
+        lua_Integer capacity = luaL_checkinteger(L, 1);
+        luaL_argcheck(L, capacity >= 0, 1, "negative capacity");
+        push_buffer(L, (size_t)capacity);
+    }
+    else if (lua_isnoneornil(L, 1))
+    {
+        push_buffer(L, 0);
+    }
+    else
+    {
+        size_t data_size;
+        const char *data = check_bytes(L, 1, &data_size);
+        luadtp_buffer_t *buffer = push_buffer(L, data_size);
+        buffer_append(buffer, data, data_size);
+    }
+
+    return 1;
+}
+
+static int l_buffer_len(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    lua_pushinteger(L, (lua_Integer)buffer->size);
+    return 1;
+}
+
+static int l_buffer_capacity(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    lua_pushinteger(L, (lua_Integer)buffer->capacity);
+    return 1;
+}
+
+static int l_buffer_append(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    size_t data_size;
+    const char *data = check_bytes(L, 2, &data_size);
+    size_t start;
+    size_t count = check_range(L, 3, data_size, &start);
+
+    if (buffer_reserve(buffer, buffer->size + count) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    // Appending a buffer to itself may have moved its data
+    if (luaL_testudata(L, 2, LUADTP_BUFFER_METATABLE) == buffer)
+    {
+        data = (const char *)buffer->data;
+    }
+
+    buffer_append(buffer, data + start, count);
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int l_buffer_write(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, offset >= 1 && (size_t)offset <= buffer->size + 1, 2, "offset out of range");
+    size_t data_size;
+    const char *data = check_bytes(L, 3, &data_size);
+    size_t end = (size_t)offset - 1 + data_size;
+
+    if (buffer_reserve(buffer, end) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    // Writing a buffer into itself may have moved its data
+    if (luaL_testudata(L, 3, LUADTP_BUFFER_METATABLE) == buffer)
+    {
+        data = (const char *)buffer->data;
+    }
+
+    if (data_size > 0)
+    {
+        memmove(buffer->data + offset - 1, data, data_size);
+    }
+
+    if (end > buffer->size)
+    {
+        buffer->size = end;
+    }
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int l_buffer_resize(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    lua_Integer size = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, size >= 0, 2, "negative size");
+
+    if (buffer_reserve(buffer, (size_t)size) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    if ((size_t)size > buffer->size)
+    {
+        memset(buffer->data + buffer->size, 0, (size_t)size - buffer->size);
+    }
+
+    buffer->size = (size_t)size;
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int l_buffer_clear(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    buffer->size = 0;
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int l_buffer_sub(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    size_t start;
+    size_t count = check_range(L, 2, buffer->size, &start);
+    lua_pushlstring(L, count > 0 ? (const char *)buffer->data + start : "", count);
+    return 1;
+}
+
+static int l_buffer_slice(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    size_t start;
+    size_t count = check_range(L, 2, buffer->size, &start);
+    luadtp_buffer_t *slice = push_buffer(L, count);
+    buffer_append(slice, buffer->data + start, count);
+    return 1;
+}
+
+static int l_buffer_byte(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    lua_Integer i = luaL_optinteger(L, 2, 1);
+
+    if (i < 0)
+    {
+        i = (lua_Integer)buffer->size + i + 1;
+    }
+
+    if (i < 1 || (size_t)i > buffer->size)
+    {
+        return 0;
+    }
+
+    lua_pushinteger(L, buffer->data[i - 1]);
+    return 1;
+}
+
+static int l_buffer_gc(lua_State *L)
+{
+    luadtp_buffer_t *buffer = check_buffer(L, 1);
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+    return 0;
+}
+
+static int l_is_buffer(lua_State *L)
+{
+    lua_pushboolean(L, luaL_testudata(L, 1, LUADTP_BUFFER_METATABLE) != NULL);
+    return 1;
+}
+
+static int l_encode_message_size(lua_State *L)
+{
+    size_t size = luaL_checkinteger(L, 1);
+    unsigned char *encoded_size = encode_message_size(size);
+    lua_pushlstring(L, (const char *)encoded_size, LENSIZE);
+    free(encoded_size);
+    return 1;
+}
+
+static int l_decode_message_size(lua_State *L)
+{
+    size_t encoded_size_len;
+    unsigned char *encoded_size = (unsigned char *)luaL_checklstring(L, 1, &encoded_size_len);
+    size_t decoded_size = decode_message_size(encoded_size);
+    lua_pushinteger(L, decoded_size);
+    return 1;
+}
+
+static int l_rsa_key_pair_new(lua_State *L)
+{
+    rsa_key_pair_t *key_pair = rsa_key_pair_new();
+
+    if (key_pair == NULL)
+    {
+        lua_pushnil(L);
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(key_pair->public_key->key), key_pair->public_key->key_size);
+        lua_pushlstring(L, (const char *)(key_pair->private_key->key), key_pair->private_key->key_size);
+        rsa_key_pair_free(key_pair);
+    }
+
+    return 2;
+}
+
+static int l_rsa_encrypt(lua_State *L)
+{
+    rsa_public_key_t public_key;
+    public_key.key = (char *)luaL_checklstring(L, 1, &(public_key.key_size));
+    size_t plaintext_size;
+    void *plaintext = (void *)luaL_checklstring(L, 2, &plaintext_size);
+    crypto_data_t *ciphertext = rsa_encrypt(&public_key, plaintext, plaintext_size);
+
+    if (ciphertext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(ciphertext->data), ciphertext->data_size);
+        crypto_data_free(ciphertext);
+    }
+
+    return 1;
+}
+
+static int l_rsa_decrypt(lua_State *L)
+{
+    rsa_private_key_t private_key;
+    private_key.key = (char *)luaL_checklstring(L, 1, &(private_key.key_size));
+    size_t ciphertext_size;
+    void *ciphertext = (void *)luaL_checklstring(L, 2, &ciphertext_size);
+    crypto_data_t *plaintext = rsa_decrypt(&private_key, ciphertext, ciphertext_size);
+
+    if (plaintext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(plaintext->data), plaintext->data_size);
+        crypto_data_free(plaintext);
+    }
+
+    return 1;
+}
+
+static int l_aes_key_new(lua_State *L)
+{
+    aes_key_t *key = aes_key_new();
+
+    if (key == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(key->key), key->key_size);
+        aes_key_free(key);
+    }
+
+    return 1;
+}
+
+static int l_aes_encrypt(lua_State *L)
+{
+    aes_key_t key;
+    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
+    size_t plaintext_size;
+    void *plaintext = (void *)luaL_checklstring(L, 2, &plaintext_size);
+    crypto_data_t *ciphertext = aes_encrypt(&key, plaintext, plaintext_size);
+
+    if (ciphertext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(ciphertext->data), ciphertext->data_size);
+        crypto_data_free(ciphertext);
+    }
+
+    return 1;
+}
+
+static int l_aes_decrypt(lua_State *L)
+{
+    aes_key_t key;
+    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
+    size_t ciphertext_size;
+    void *ciphertext = (void *)luaL_checklstring(L, 2, &ciphertext_size);
+    crypto_data_t *plaintext = aes_decrypt(&key, ciphertext, ciphertext_size);
+
+    if (plaintext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(plaintext->data), plaintext->data_size);
+        crypto_data_free(plaintext);
+    }
+
+    return 1;
+}
+
+static int l_aes_encrypt_into(lua_State *L)
+{
+    size_t key_size;
+    const char *key = luaL_checklstring(L, 1, &key_size);
+    size_t plaintext_size;
+    const char *plaintext = check_bytes(L, 2, &plaintext_size);
+    luadtp_buffer_t *out = check_buffer(L, 3);
+    luaL_argcheck(L, luaL_testudata(L, 2, LUADTP_BUFFER_METATABLE) != out, 2, "input and output must differ");
+
+    if (buffer_reserve(out, out->size + luadtp_aes_encrypted_size(plaintext_size)) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    int ciphertext_size = luadtp_aes_encrypt(key, key_size, plaintext, plaintext_size, out->data + out->size);
+
+    if (ciphertext_size < 0)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        out->size += (size_t)ciphertext_size;
+        lua_pushinteger(L, (lua_Integer)out->size);
+    }
+
+    return 1;
+}
+
+static int l_aes_decrypt_into(lua_State *L)
+{
+    size_t key_size;
+    const char *key = luaL_checklstring(L, 1, &key_size);
+    size_t input_size;
+    const char *input = check_bytes(L, 2, &input_size);
+    lua_Integer offset = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, offset >= 1 && (size_t)offset <= input_size + 1, 3, "offset out of range");
+    luadtp_buffer_t *out = check_buffer(L, 4);
+    luaL_argcheck(L, luaL_testudata(L, 2, LUADTP_BUFFER_METATABLE) != out, 2, "input and output must differ");
+    size_t ciphertext_size = input_size - (size_t)(offset - 1);
+
+    if (buffer_reserve(out, out->size + ciphertext_size) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    int plaintext_size = luadtp_aes_decrypt(key, key_size, input + offset - 1, ciphertext_size, out->data + out->size);
+
+    if (plaintext_size < 0)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        out->size += (size_t)plaintext_size;
+        lua_pushinteger(L, (lua_Integer)out->size);
+    }
+
+    return 1;
+}
+
+static int l_encode_frame_into(lua_State *L)
+{
+    size_t key_size = 0;
+    const char *key = luaL_optlstring(L, 1, NULL, &key_size);
+    lua_Integer kind = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, kind >= 0 && kind <= 255, 2, "invalid frame kind");
+    size_t header_size;
+    const char *header = luaL_checklstring(L, 3, &header_size);
+    size_t payload_size;
+    const char *payload = check_bytes(L, 4, &payload_size);
+    luadtp_buffer_t *out = check_buffer(L, 5);
+    luaL_argcheck(L, luaL_testudata(L, 4, LUADTP_BUFFER_METATABLE) != out, 4, "input and output must differ");
+    int sealed = lua_toboolean(L, 6);
+    size_t prefix_size = LENSIZE + 1 + header_size;
+    size_t encoded_payload_size = payload_size;
+
+    if (key != NULL)
+    {
+        encoded_payload_size = sealed ? AEAD_NONCE_SIZE + payload_size + AEAD_TAG_SIZE : luadtp_aes_encrypted_size(payload_size);
+    }
+
+    if (buffer_reserve(out, prefix_size + encoded_payload_size) == 0)
+    {
+        return luaL_error(L, "buffer allocation failed");
+    }
+
+    out->size = 0;
+    out->data[LENSIZE] = (unsigned char)kind;
+    memcpy(out->data + LENSIZE + 1, header, header_size);
+
+    if (key != NULL)
+    {
+        int ciphertext_size = sealed
+                                  ? aead_seal_into(key, key_size, header, header_size, payload, payload_size, out->data + prefix_size)
+                                  : luadtp_aes_encrypt(key, key_size, payload, payload_size, out->data + prefix_size);
+
+        if (ciphertext_size < 0)
+        {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        encoded_payload_size = (size_t)ciphertext_size;
+    }
+    else if (payload_size > 0)
+    {
+        memcpy(out->data + prefix_size, payload, payload_size);
+    }
+
+    out->size = prefix_size + encoded_payload_size;
+    luadtp_encode_message_size(out->size - LENSIZE, out->data);
+    lua_pushvalue(L, 5);
+
+    return 1;
+}
+
+static int l_aead_encrypt(lua_State *L)
+{
+    aes_key_t key;
+    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
+    size_t nonce_size;
+    unsigned char *nonce = (unsigned char *)luaL_checklstring(L, 2, &nonce_size);
+    luaL_argcheck(L, nonce_size == AEAD_NONCE_SIZE, 2, "invalid nonce size");
+    size_t aad_size;
+    void *aad = (void *)luaL_checklstring(L, 3, &aad_size);
+    size_t plaintext_size;
+    void *plaintext = (void *)luaL_checklstring(L, 4, &plaintext_size);
+    crypto_data_t *ciphertext = aead_encrypt(&key, nonce, aad, aad_size, plaintext, plaintext_size);
+
+    if (ciphertext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(ciphertext->data), ciphertext->data_size);
+        crypto_data_free(ciphertext);
+    }
+
+    return 1;
+}
+
+static int l_aead_decrypt(lua_State *L)
+{
+    aes_key_t key;
+    key.key = (char *)luaL_checklstring(L, 1, &(key.key_size));
+    size_t nonce_size;
+    unsigned char *nonce = (unsigned char *)luaL_checklstring(L, 2, &nonce_size);
+    luaL_argcheck(L, nonce_size == AEAD_NONCE_SIZE, 2, "invalid nonce size");
+    size_t aad_size;
+    void *aad = (void *)luaL_checklstring(L, 3, &aad_size);
+    size_t ciphertext_size;
+    void *ciphertext = (void *)luaL_checklstring(L, 4, &ciphertext_size);
+    crypto_data_t *plaintext = aead_decrypt(&key, nonce, aad, aad_size, ciphertext, ciphertext_size);
+
+    if (plaintext == NULL)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)(plaintext->data), plaintext->data_size);
+        crypto_data_free(plaintext);
+    }
+
+    return 1;
+}
+
+static int l_hmac_sha256(lua_State *L)
+{
+    size_t key_size;
+    void *key = (void *)luaL_checklstring(L, 1, &key_size);
+    size_t data_size;
+    void *data = (void *)luaL_checklstring(L, 2, &data_size);
+    unsigned char digest[HMAC_SHA256_SIZE];
+
+    if (hmac_sha256(key, key_size, data, data_size, digest) == 0)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushlstring(L, (const char *)digest, HMAC_SHA256_SIZE);
+    }
+
+    return 1;
+}
+
+static int l_get_openssl_error(lua_State *L)
+{
+    unsigned long err = get_openssl_error();
+    lua_pushinteger(L, err);
+    return 1;
+}
+
+static int l_sleep(lua_State *L)
+{
+    double seconds = luaL_checknumber(L, 1);
+
+#ifdef _WIN32
+    Sleep(seconds * 1000);
+#else
+    struct timespec ts;
+    ts.tv_sec = seconds;
+    ts.tv_nsec = ((int)(seconds * 1000) % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+#endif
+
+    return 0;
+}
+
+static const struct luaL_Reg luadtpcryptocorelib[] = {
+    {"encode_message_size", l_encode_message_size},
+    {"decode_message_size", l_decode_message_size},
+    {"rsa_key_pair_new", l_rsa_key_pair_new},
+    {"rsa_encrypt", l_rsa_encrypt},
+    {"rsa_decrypt", l_rsa_decrypt},
+    {"aes_key_new", l_aes_key_new},
+    {"aes_encrypt", l_aes_encrypt},
+    {"aes_decrypt", l_aes_decrypt},
+    {"aes_encrypt_into", l_aes_encrypt_into},
+    {"aes_decrypt_into", l_aes_decrypt_into},
+    {"encode_frame_into", l_encode_frame_into},
+    {"buffer_new", l_buffer_new},
+    {"is_buffer", l_is_buffer},
+    {"aead_encrypt", l_aead_encrypt},
+    {"aead_decrypt", l_aead_decrypt},
+    {"hmac_sha256", l_hmac_sha256},
+    {"get_openssl_error", l_get_openssl_error},
+    {"sleep", l_sleep},
+    {NULL, NULL}};
+
+static const struct luaL_Reg luadtpbuffermethods[] = {
+    {"len", l_buffer_len},
+    {"capacity", l_buffer_capacity},
+    {"append", l_buffer_append},
+    {"write", l_buffer_write},
+    {"resize", l_buffer_resize},
+    {"clear", l_buffer_clear},
+    {"sub", l_buffer_sub},
+    {"slice", l_buffer_slice},
+    {"byte", l_buffer_byte},
+    {"__len", l_buffer_len},
+    {"__tostring", l_buffer_sub},
+    {"__gc", l_buffer_gc},
+    {NULL, NULL}};
+
+LUADTPCRYPTOCORE_API int luaopen_luadtp_cryptocore(lua_State *L)
+{
+    luaL_newmetatable(L, LUADTP_BUFFER_METATABLE);
+    luaL_setfuncs(L, luadtpbuffermethods, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
 
-LUADTPCRYPTOCORE_API int luaopen_luadtp_cryptocore(lua_State *L)
-{
     luaL_newlib(L, luadtpcryptocorelib);
     return 1;
 }
@@ -1,6 +1,8 @@
 #ifndef LUADTPCRYPTOCORE_H
+#define LUADTPCRYPTOCORE_H
 
 #include <lua.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 #define LUADTPCRYPTOCORE_API __declspec(dllexport)
@@ -8,6 +10,34 @@
 #define LUADTPCRYPTOCORE_API __attribute__((visibility("default")))
 #endif
 
+// The name of the metatable of byte buffers.
+#define LUADTP_BUFFER_METATABLE "luadtp.cryptocore.buffer"
+
+/*
+ * A mutable, resizable byte buffer. Buffers are exposed to Lua as userdata,
+ * so that payloads can be passed between the sockets, the crypto functions
+ * and the application without creating intermediate Lua strings. Other
+ * native modules may read buffers through this layout.
+ */
+typedef struct luadtp_buffer
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} luadtp_buffer_t;
+
 LUADTPCRYPTOCORE_API int luaopen_luadtp_cryptocore(lua_State *L);
 
+/*
+ * A stable C ABI over the hot-path functions, for callers that bind the
+ * library directly instead of going through the Lua C API (e.g. the LuaJIT
+ * FFI). Buffers are owned by the caller.
+ */
+
+LUADTPCRYPTOCORE_API size_t luadtp_aes_encrypted_size(size_t plaintext_size);
+LUADTPCRYPTOCORE_API int luadtp_aes_encrypt(const char *key, size_t key_size, const char *plaintext, size_t plaintext_size, unsigned char *out);
+LUADTPCRYPTOCORE_API int luadtp_aes_decrypt(const char *key, size_t key_size, const char *ciphertext, size_t ciphertext_size, unsigned char *out);
+LUADTPCRYPTOCORE_API void luadtp_encode_message_size(size_t size, unsigned char *out);
+LUADTPCRYPTOCORE_API size_t luadtp_decode_message_size(const char *encoded_size);
+
 #endif /* LUADTPCRYPTOCORE_H */
@@ -0,0 +1,1017 @@
+#include <lua.h>
+#include <lauxlib.h>
+#include "luadtpshmcore.h"
+#include "luadtpcryptocore.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// The metatable name for shared memory connections.
+#define SHM_CONN_METATABLE "luadtp.shmcore.conn"
+
+// The metatable name for shared memory listeners.
+#define SHM_LISTENER_METATABLE "luadtp.shmcore.listener"
+
+#ifndef _WIN32
+
+// Identifies regions created by this library.
+#define SHM_MAGIC 0x4c445450
+
+// The capacity of each ring, in bytes. Must be a power of two.
+#define SHM_RING_CAPACITY (1 << 20)
+
+// The number of connection requests a listener can hold at once.
+#define SHM_LISTENER_SLOTS 64
+
+// The maximum size of a region name, including the terminating null byte.
+#define SHM_NAME_SIZE 64
+
+// Listener slot states.
+#define SHM_SLOT_FREE 0
+#define SHM_SLOT_WRITING 1
+#define SHM_SLOT_READY 2
+#define SHM_SLOT_TAKING 3
+
+// Connection state flags.
+#define SHM_STATE_ACCEPTED 1
+#define SHM_STATE_CLIENT_CLOSED 2
+#define SHM_STATE_SERVER_CLOSED 4
+
+// The ring written by the client and read by the server.
+#define SHM_RING_CLIENT_TO_SERVER 0
+
+// The ring written by the server and read by the client.
+#define SHM_RING_SERVER_TO_CLIENT 1
+
+// How long to sleep between checks on platforms without futexes, in seconds.
+#define SHM_POLL_INTERVAL 0.00005
+
+/**
+ * A single-producer/single-consumer byte ring. The head and tail are kept on separate cache lines so that the
+ * producer and consumer do not contend with each other.
+ */
+typedef struct shm_ring
+{
+    _Atomic uint64_t head;
+    char head_padding[56];
+    _Atomic uint64_t tail;
+    char tail_padding[56];
+    _Atomic uint32_t data_seq;
+    _Atomic uint32_t data_waiters;
+    _Atomic uint32_t space_seq;
+    _Atomic uint32_t space_waiters;
+    char seq_padding[48];
+} shm_ring_t;
+
+/**
+ * The header of a connection region. The ring data follows the header, one ring after the other.
+ */
+typedef struct shm_conn_region
+{
+    uint32_t magic;
+    uint32_t encrypted;
+    uint32_t capacity;
+    _Atomic uint32_t state;
+    char header_padding[48];
+    shm_ring_t rings[2];
+} shm_conn_region_t;
+
+/**
+ * A listener region, through which clients hand the names of their connection regions to the server.
+ */
+typedef struct shm_listener_region
+{
+    uint32_t magic;
+    uint32_t encrypted;
+    int32_t owner_pid;
+    _Atomic uint32_t accept_seq;
+    _Atomic uint32_t slot_states[SHM_LISTENER_SLOTS];
+    char slot_names[SHM_LISTENER_SLOTS][SHM_NAME_SIZE];
+} shm_listener_region_t;
+
+/**
+ * One end of a shared memory connection.
+ */
+typedef struct shm_conn
+{
+    shm_conn_region_t *region;
+    size_t region_size;
+    size_t capacity;
+    int is_server;
+} shm_conn_t;
+
+/**
+ * A shared memory listener.
+ */
+typedef struct shm_listener
+{
+    shm_listener_region_t *region;
+    char name[SHM_NAME_SIZE];
+    uint32_t seen_seq;
+} shm_listener_t;
+
+/**
+ * Get the current monotonic time.
+ *
+ * @return The time, in seconds.
+ */
+double shm_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Wait until a shared word no longer holds an expected value, or a timeout elapses.
+ *
+ * @param word The word to wait on.
+ * @param expected The value the word is expected to hold.
+ * @param timeout The maximum time to wait, in seconds. Negative values wait indefinitely.
+ */
+void shm_futex_wait(_Atomic uint32_t *word, uint32_t expected, double timeout)
+{
+#ifdef __linux__
+    struct timespec ts;
+    struct timespec *tsp = NULL;
+
+    if (timeout >= 0)
+    {
+        ts.tv_sec = (time_t)timeout;
+        ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1e9);
+        tsp = &ts;
+    }
+
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, tsp, NULL, 0);
+#else
+    if (atomic_load(word) != expected)
+    {
+        return;
+    }
+
+    double interval = (timeout >= 0 && timeout < SHM_POLL_INTERVAL) ? timeout : SHM_POLL_INTERVAL;
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)(interval * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/**
+ * Wake every process waiting on a shared word.
+ *
+ * @param word The word being waited on.
+ */
+void shm_futex_wake(_Atomic uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+/**
+ * Get a pointer to the data of one of a connection's rings.
+ *
+ * @param conn The connection.
+ * @param ring_index The index of the ring.
+ * @return The ring data.
+ */
+unsigned char *shm_ring_data(shm_conn_t *conn, int ring_index)
+{
+    return ((unsigned char *)conn->region) + sizeof(shm_conn_region_t) + (size_t)ring_index * conn->capacity;
+}
+
+/**
+ * Check whether a ring capacity read from a connection region is usable. Ring offsets are computed by masking, so
+ * the capacity must be a nonzero power of two.
+ *
+ * @param capacity The ring capacity.
+ * @return Whether the capacity is valid.
+ */
+int shm_ring_capacity_valid(uint32_t capacity)
+{
+    return capacity != 0 && (capacity & (capacity - 1)) == 0;
+}
+
+/**
+ * Get the number of bytes in use in a ring. The head and tail live in memory the peer can write to, so the result
+ * is clamped to the capacity rather than trusted.
+ *
+ * @param head The ring head.
+ * @param tail The ring tail.
+ * @param capacity The ring capacity.
+ * @return The number of bytes in use.
+ */
+size_t shm_ring_used(uint64_t head, uint64_t tail, size_t capacity)
+{
+    uint64_t used = head - tail;
+    return used > capacity ? capacity : (size_t)used;
+}
+
+/**
+ * Get the number of bytes available to read from a ring.
+ *
+ * @param ring The ring.
+ * @param capacity The ring capacity.
+ * @return The number of readable bytes.
+ */
+size_t shm_ring_readable(shm_ring_t *ring, size_t capacity)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return shm_ring_used(head, tail, capacity);
+}
+
+/**
+ * Get the number of bytes that can be written to a ring.
+ *
+ * @param ring The ring.
+ * @param capacity The ring capacity.
+ * @return The number of writable bytes.
+ */
+size_t shm_ring_writable(shm_ring_t *ring, size_t capacity)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return capacity - shm_ring_used(head, tail, capacity);
+}
+
+/**
+ * Write as many bytes as fit to a ring, waking the reader if it is waiting.
+ *
+ * @param ring The ring.
+ * @param data The ring data.
+ * @param capacity The ring capacity.
+ * @param src The bytes to write.
+ * @param size The number of bytes to write.
+ * @return The number of bytes written.
+ */
+size_t shm_ring_write(shm_ring_t *ring, unsigned char *data, size_t capacity, const unsigned char *src, size_t size)
+{
+    size_t space = shm_ring_writable(ring, capacity);
+    size_t count = size < space ? size : space;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t offset = (size_t)(head & (capacity - 1));
+    size_t first = capacity - offset < count ? capacity - offset : count;
+    memcpy(data + offset, src, first);
+    memcpy(data, src + first, count - first);
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+
+    atomic_fetch_add(&ring->data_seq, 1);
+
+    if (atomic_load(&ring->data_waiters) > 0)
+    {
+        shm_futex_wake(&ring->data_seq);
+    }
+
+    return count;
+}
+
+/**
+ * Read bytes from a ring, waking the writer if it is waiting.
+ *
+ * @param ring The ring.
+ * @param data The ring data.
+ * @param capacity The ring capacity.
+ * @param dest Where to copy the bytes to.
+ * @param count The number of bytes to read. This must not exceed the number of readable bytes.
+ */
+void shm_ring_read(shm_ring_t *ring, unsigned char *data, size_t capacity, unsigned char *dest, size_t count)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t offset = (size_t)(tail & (capacity - 1));
+    size_t first = capacity - offset < count ? capacity - offset : count;
+    memcpy(dest, data + offset, first);
+    memcpy(dest + first, data, count - first);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+
+    atomic_fetch_add(&ring->space_seq, 1);
+
+    if (atomic_load(&ring->space_waiters) > 0)
+    {
+        shm_futex_wake(&ring->space_seq);
+    }
+}
+
+/**
+ * Get the ring a connection end reads from.
+ *
+ * @param conn The connection.
+ * @return The ring index.
+ */
+int shm_conn_read_ring(shm_conn_t *conn)
+{
+    return conn->is_server ? SHM_RING_CLIENT_TO_SERVER : SHM_RING_SERVER_TO_CLIENT;
+}
+
+/**
+ * Get the ring a connection end writes to.
+ *
+ * @param conn The connection.
+ * @return The ring index.
+ */
+int shm_conn_write_ring(shm_conn_t *conn)
+{
+    return conn->is_server ? SHM_RING_SERVER_TO_CLIENT : SHM_RING_CLIENT_TO_SERVER;
+}
+
+/**
+ * Check whether the other end of a connection has closed it.
+ *
+ * @param conn The connection.
+ * @return Whether the peer has closed the connection.
+ */
+int shm_conn_peer_closed(shm_conn_t *conn)
+{
+    uint32_t peer_flag = conn->is_server ? SHM_STATE_CLIENT_CLOSED : SHM_STATE_SERVER_CLOSED;
+    return (atomic_load(&conn->region->state) & peer_flag) != 0;
+}
+
+/**
+ * Map a shared memory object into memory.
+ *
+ * @param fd The shared memory file descriptor.
+ * @param size The size of the mapping.
+ * @return The mapped memory, or NULL on failure.
+ */
+void *shm_map(int fd, size_t size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+/**
+ * Build the shared memory object name for a listener.
+ *
+ * @param name The name given by the user.
+ * @param out Where to write the object name.
+ * @return 0 on success, or -1 if the name is too long.
+ */
+int shm_listener_name(const char *name, char *out)
+{
+    int len = snprintf(out, SHM_NAME_SIZE, "/ldtp.%s", name);
+    return (len < 0 || len >= SHM_NAME_SIZE) ? -1 : 0;
+}
+
+/**
+ * Create a listener.
+ *
+ * @param name The name clients connect to.
+ * @param encrypted Whether connections should perform a key exchange and encrypt their traffic.
+ * @param listener The listener to initialize.
+ * @return NULL on success, or an error message.
+ */
+const char *shm_listen(const char *name, int encrypted, shm_listener_t *listener)
+{
+    if (shm_listener_name(name, listener->name) != 0)
+    {
+        return "name too long";
+    }
+
+    int fd = shm_open(listener->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        // Reclaim the name if the server that created it no longer exists
+        int existing_fd = shm_open(listener->name, O_RDWR, 0600);
+
+        if (existing_fd >= 0)
+        {
+            shm_listener_region_t *existing = (shm_listener_region_t *)shm_map(existing_fd, sizeof(shm_listener_region_t));
+            close(existing_fd);
+
+            if (existing != NULL)
+            {
+                int stale = existing->magic != SHM_MAGIC || (kill((pid_t)existing->owner_pid, 0) != 0 && errno == ESRCH);
+                munmap(existing, sizeof(shm_listener_region_t));
+
+                if (!stale)
+                {
+                    return "address already in use";
+                }
+            }
+        }
+
+        shm_unlink(listener->name);
+        fd = shm_open(listener->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+
+    if (fd < 0)
+    {
+        return strerror(errno);
+    }
+
+    if (ftruncate(fd, sizeof(shm_listener_region_t)) != 0)
+    {
+        close(fd);
+        shm_unlink(listener->name);
+        return strerror(errno);
+    }
+
+    listener->region = (shm_listener_region_t *)shm_map(fd, sizeof(shm_listener_region_t));
+    close(fd);
+
+    if (listener->region == NULL)
+    {
+        shm_unlink(listener->name);
+        return strerror(errno);
+    }
+
+    listener->region->encrypted = (uint32_t)encrypted;
+    listener->region->owner_pid = (int32_t)getpid();
+    listener->region->magic = SHM_MAGIC;
+    listener->seen_seq = 0;
+
+    return NULL;
+}
+
+/**
+ * Accept a pending connection, if there is one.
+ *
+ * @param listener The listener.
+ * @param conn The connection to initialize.
+ * @return 1 if a connection was accepted, 0 otherwise.
+ */
+int shm_accept(shm_listener_t *listener, shm_conn_t *conn)
+{
+    shm_listener_region_t *region = listener->region;
+    uint32_t seq = atomic_load(&region->accept_seq);
+
+    if (seq == listener->seen_seq)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < SHM_LISTENER_SLOTS; i++)
+    {
+        uint32_t expected = SHM_SLOT_READY;
+
+        if (!atomic_compare_exchange_strong(&region->slot_states[i], &expected, SHM_SLOT_TAKING))
+        {
+            continue;
+        }
+
+        char conn_name[SHM_NAME_SIZE];
+        memcpy(conn_name, region->slot_names[i], SHM_NAME_SIZE);
+        conn_name[SHM_NAME_SIZE - 1] = '\0';
+        atomic_store(&region->slot_states[i], SHM_SLOT_FREE);
+
+        int fd = shm_open(conn_name, O_RDWR, 0600);
+        shm_unlink(conn_name);
+
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shm_conn_region_t))
+        {
+            close(fd);
+            continue;
+        }
+
+        shm_conn_region_t *conn_region = (shm_conn_region_t *)shm_map(fd, (size_t)st.st_size);
+        close(fd);
+
+        if (conn_region == NULL)
+        {
+            continue;
+        }
+
+        // The capacity is read once and kept, so that the peer cannot change it once it has been validated
+        uint32_t capacity = conn_region->capacity;
+
+        if (conn_region->magic != SHM_MAGIC || !shm_ring_capacity_valid(capacity) ||
+            sizeof(shm_conn_region_t) + 2 * (size_t)capacity > (size_t)st.st_size)
+        {
+            munmap(conn_region, (size_t)st.st_size);
+            continue;
+        }
+
+        conn->region = conn_region;
+        conn->region_size = (size_t)st.st_size;
+        conn->capacity = capacity;
+        conn->is_server = 1;
+
+        atomic_fetch_or(&conn_region->state, SHM_STATE_ACCEPTED);
+        shm_futex_wake(&conn_region->state);
+
+        return 1;
+    }
+
+    listener->seen_seq = seq;
+
+    return 0;
+}
+
+/**
+ * Close a listener, removing its name.
+ *
+ * @param listener The listener.
+ */
+void shm_listener_close(shm_listener_t *listener)
+{
+    if (listener->region != NULL)
+    {
+        shm_unlink(listener->name);
+        munmap(listener->region, sizeof(shm_listener_region_t));
+        listener->region = NULL;
+    }
+}
+
+/**
+ * Connect to a listener.
+ *
+ * @param name The name the listener was created with.
+ * @param timeout How long to wait for the server to accept the connection, in seconds.
+ * @param conn The connection to initialize.
+ * @return NULL on success, or an error message.
+ */
+const char *shm_connect(const char *name, double timeout, shm_conn_t *conn)
+{
+    static unsigned int counter = 0;
+    char listener_name[SHM_NAME_SIZE];
+    char conn_name[SHM_NAME_SIZE];
+
+    if (shm_listener_name(name, listener_name) != 0)
+    {
+        return "name too long";
+    }
+
+    int listener_fd = shm_open(listener_name, O_RDWR, 0600);
+
+    if (listener_fd < 0)
+    {
+        return "connection refused";
+    }
+
+    shm_listener_region_t *listener = (shm_listener_region_t *)shm_map(listener_fd, sizeof(shm_listener_region_t));
+    close(listener_fd);
+
+    if (listener == NULL)
+    {
+        return strerror(errno);
+    }
+
+    if (listener->magic != SHM_MAGIC)
+    {
+        munmap(listener, sizeof(shm_listener_region_t));
+        return "connection refused";
+    }
+
+    snprintf(conn_name, SHM_NAME_SIZE, "/ldtp.%x.%x", (unsigned int)getpid(), counter++);
+    size_t region_size = sizeof(shm_conn_region_t) + 2 * (size_t)SHM_RING_CAPACITY;
+    int fd = shm_open(conn_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0)
+    {
+        munmap(listener, sizeof(shm_listener_region_t));
+        return strerror(errno);
+    }
+
+    if (ftruncate(fd, (off_t)region_size) != 0)
+    {
+        close(fd);
+        shm_unlink(conn_name);
+        munmap(listener, sizeof(shm_listener_region_t));
+        return strerror(errno);
+    }
+
+    shm_conn_region_t *region = (shm_conn_region_t *)shm_map(fd, region_size);
+    close(fd);
+
+    if (region == NULL)
+    {
+        shm_unlink(conn_name);
+        munmap(listener, sizeof(shm_listener_region_t));
+        return strerror(errno);
+    }
+
+    region->encrypted = listener->encrypted;
+    region->capacity = SHM_RING_CAPACITY;
+    region->magic = SHM_MAGIC;
+
+    int claimed = 0;
+
+    for (int i = 0; i < SHM_LISTENER_SLOTS && !claimed; i++)
+    {
+        uint32_t expected = SHM_SLOT_FREE;
+
+        if (atomic_compare_exchange_strong(&listener->slot_states[i], &expected, SHM_SLOT_WRITING))
+        {
+            memcpy(listener->slot_names[i], conn_name, SHM_NAME_SIZE);
+            atomic_store(&listener->slot_states[i], SHM_SLOT_READY);
+            atomic_fetch_add(&listener->accept_seq, 1);
+            claimed = 1;
+        }
+    }
+
+    munmap(listener, sizeof(shm_listener_region_t));
+
+    if (!claimed)
+    {
+        shm_unlink(conn_name);
+        munmap(region, region_size);
+        return "connection refused";
+    }
+
+    double deadline = shm_now() + timeout;
+
+    while (1)
+    {
+        uint32_t state = atomic_load(&region->state);
+
+        if (state & SHM_STATE_ACCEPTED)
+        {
+            break;
+        }
+
+        double remaining = deadline - shm_now();
+
+        if (remaining <= 0)
+        {
+            // The server will fail to open the region once its name is gone
+            shm_unlink(conn_name);
+            munmap(region, region_size);
+            return "timeout";
+        }
+
+        shm_futex_wait(&region->state, state, remaining);
+    }
+
+    conn->region = region;
+    conn->region_size = region_size;
+    conn->capacity = SHM_RING_CAPACITY;
+    conn->is_server = 0;
+
+    return NULL;
+}
+
+/**
+ * Wait until a connection has data to read or the peer has closed it.
+ *
+ * @param conn The connection.
+ * @param timeout The maximum time to wait, in seconds. Negative values wait indefinitely.
+ * @return Whether the connection became readable.
+ */
+int shm_conn_wait_readable(shm_conn_t *conn, double timeout)
+{
+    shm_ring_t *ring = &conn->region->rings[shm_conn_read_ring(conn)];
+    uint32_t seq = atomic_load(&ring->data_seq);
+
+    if (shm_ring_readable(ring, conn->capacity) > 0 || shm_conn_peer_closed(conn))
+    {
+        return 1;
+    }
+
+    atomic_fetch_add(&ring->data_waiters, 1);
+
+    if (shm_ring_readable(ring, conn->capacity) == 0 && !shm_conn_peer_closed(conn))
+    {
+        shm_futex_wait(&ring->data_seq, seq, timeout);
+    }
+
+    atomic_fetch_sub(&ring->data_waiters, 1);
+
+    return shm_ring_readable(ring, conn->capacity) > 0 || shm_conn_peer_closed(conn);
+}
+
+/**
+ * Wait until a connection has room to write or the peer has closed it.
+ *
+ * @param conn The connection.
+ * @param timeout The maximum time to wait, in seconds. Negative values wait indefinitely.
+ * @return Whether the connection became writable.
+ */
+int shm_conn_wait_writable(shm_conn_t *conn, double timeout)
+{
+    shm_ring_t *ring = &conn->region->rings[shm_conn_write_ring(conn)];
+    size_t capacity = conn->capacity;
+    uint32_t seq = atomic_load(&ring->space_seq);
+
+    if (shm_ring_writable(ring, capacity) > 0 || shm_conn_peer_closed(conn))
+    {
+        return 1;
+    }
+
+    atomic_fetch_add(&ring->space_waiters, 1);
+
+    if (shm_ring_writable(ring, capacity) == 0 && !shm_conn_peer_closed(conn))
+    {
+        shm_futex_wait(&ring->space_seq, seq, timeout);
+    }
+
+    atomic_fetch_sub(&ring->space_waiters, 1);
+
+    return shm_ring_writable(ring, capacity) > 0 || shm_conn_peer_closed(conn);
+}
+
+/**
+ * Close one end of a connection, waking the peer so that it notices.
+ *
+ * @param conn The connection.
+ */
+void shm_conn_close(shm_conn_t *conn)
+{
+    if (conn->region != NULL)
+    {
+        shm_conn_region_t *region = conn->region;
+        atomic_fetch_or(&region->state, conn->is_server ? SHM_STATE_SERVER_CLOSED : SHM_STATE_CLIENT_CLOSED);
+
+        for (int i = 0; i < 2; i++)
+        {
+            atomic_fetch_add(&region->rings[i].data_seq, 1);
+            atomic_fetch_add(&region->rings[i].space_seq, 1);
+            shm_futex_wake(&region->rings[i].data_seq);
+            shm_futex_wake(&region->rings[i].space_seq);
+        }
+
+        munmap(region, conn->region_size);
+        conn->region = NULL;
+    }
+}
+
+static shm_conn_t *check_conn(lua_State *L)
+{
+    shm_conn_t *conn = (shm_conn_t *)luaL_checkudata(L, 1, SHM_CONN_METATABLE);
+    luaL_argcheck(L, conn->region != NULL, 1, "connection is closed");
+    return conn;
+}
+
+static shm_listener_t *check_listener(lua_State *L)
+{
+    shm_listener_t *listener = (shm_listener_t *)luaL_checkudata(L, 1, SHM_LISTENER_METATABLE);
+    luaL_argcheck(L, listener->region != NULL, 1, "listener is closed");
+    return listener;
+}
+
+static int l_listen(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    int encrypted = lua_toboolean(L, 2);
+    shm_listener_t *listener = (shm_listener_t *)lua_newuserdata(L, sizeof(shm_listener_t));
+    listener->region = NULL;
+    luaL_setmetatable(L, SHM_LISTENER_METATABLE);
+    const char *err = shm_listen(name, encrypted, listener);
+
+    if (err != NULL)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+
+    return 1;
+}
+
+static int l_connect(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    double timeout = luaL_optnumber(L, 2, 5);
+    shm_conn_t *conn = (shm_conn_t *)lua_newuserdata(L, sizeof(shm_conn_t));
+    conn->region = NULL;
+    luaL_setmetatable(L, SHM_CONN_METATABLE);
+    const char *err = shm_connect(name, timeout, conn);
+
+    if (err != NULL)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+
+    return 1;
+}
+
+static int l_listener_accept(lua_State *L)
+{
+    shm_listener_t *listener = check_listener(L);
+    shm_conn_t accepted;
+
+    if (!shm_accept(listener, &accepted))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    shm_conn_t *conn = (shm_conn_t *)lua_newuserdata(L, sizeof(shm_conn_t));
+    *conn = accepted;
+    luaL_setmetatable(L, SHM_CONN_METATABLE);
+
+    return 1;
+}
+
+static int l_listener_close(lua_State *L)
+{
+    shm_listener_t *listener = (shm_listener_t *)luaL_checkudata(L, 1, SHM_LISTENER_METATABLE);
+    shm_listener_close(listener);
+    return 0;
+}
+
+static int l_conn_read(lua_State *L)
+{
+    shm_conn_t *conn = check_conn(L);
+    size_t max = (size_t)luaL_checkinteger(L, 2);
+    int ring_index = shm_conn_read_ring(conn);
+    shm_ring_t *ring = &conn->region->rings[ring_index];
+    size_t available = shm_ring_readable(ring, conn->capacity);
+    size_t count = available < max ? available : max;
+
+    if (count == 0 && shm_conn_peer_closed(conn) && shm_ring_readable(ring, conn->capacity) == 0)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+
+    unsigned char *data = shm_ring_data(conn, ring_index);
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    // Lua 5.1 and LuaJIT have no sized buffers, so the bytes are copied out in buffer-sized pieces
+    while (count > 0)
+    {
+        size_t piece = count < LUAL_BUFFERSIZE ? count : LUAL_BUFFERSIZE;
+        shm_ring_read(ring, data, conn->capacity, (unsigned char *)luaL_prepbuffer(&b), piece);
+        luaL_addsize(&b, piece);
+        count -= piece;
+    }
+
+    luaL_pushresult(&b);
+
+    return 1;
+}
+
+static int l_conn_write(lua_State *L)
+{
+    shm_conn_t *conn = check_conn(L);
+    size_t data_size;
+    const char *data;
+    luadtp_buffer_t *buffer = (luadtp_buffer_t *)luaL_testudata(L, 2, LUADTP_BUFFER_METATABLE);
+
+    // Buffers are written straight from their memory, without being turned into strings
+    if (buffer != NULL)
+    {
+        data = (const char *)buffer->data;
+        data_size = buffer->size;
+    }
+    else
+    {
+        data = luaL_checklstring(L, 2, &data_size);
+    }
+
+    size_t offset = (size_t)luaL_optinteger(L, 3, 0);
+    luaL_argcheck(L, offset <= data_size, 3, "offset out of range");
+
+    if (shm_conn_peer_closed(conn))
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "closed");
+        return 2;
+    }
+
+    int ring_index = shm_conn_write_ring(conn);
+    size_t written = shm_ring_write(&conn->region->rings[ring_index], shm_ring_data(conn, ring_index), conn->capacity, (const unsigned char *)data + offset, data_size - offset);
+    lua_pushinteger(L, (lua_Integer)written);
+
+    return 1;
+}
+
+static int l_conn_wait_readable(lua_State *L)
+{
+    shm_conn_t *conn = check_conn(L);
+    double timeout = luaL_optnumber(L, 2, -1);
+    lua_pushboolean(L, shm_conn_wait_readable(conn, timeout));
+    return 1;
+}
+
+static int l_conn_wait_writable(lua_State *L)
+{
+    shm_conn_t *conn = check_conn(L);
+    double timeout = luaL_optnumber(L, 2, -1);
+    lua_pushboolean(L, shm_conn_wait_writable(conn, timeout));
+    return 1;
+}
+
+static int l_conn_encrypted(lua_State *L)
+{
+    shm_conn_t *conn = check_conn(L);
+    lua_pushboolean(L, conn->region->encrypted != 0);
+    return 1;
+}
+
+static int l_conn_close(lua_State *L)
+{
+    shm_conn_t *conn = (shm_conn_t *)luaL_checkudata(L, 1, SHM_CONN_METATABLE);
+    shm_conn_close(conn);
+    return 0;
+}
+
+static int l_supported(lua_State *L)
+{
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+#else
+
+static int l_unsupported(lua_State *L)
+{
+    lua_pushnil(L);
+    lua_pushstring(L, "shared memory transport is not supported on this platform");
+    return 2;
+}
+
+static int l_supported(lua_State *L)
+{
+    lua_pushboolean(L, 0);
+    return 1;
+}
+
+#define l_listen l_unsupported
+#define l_connect l_unsupported
+#define l_listener_accept l_unsupported
+#define l_listener_close l_unsupported
+#define l_conn_read l_unsupported
+#define l_conn_write l_unsupported
+#define l_conn_wait_readable l_unsupported
+#define l_conn_wait_writable l_unsupported
+#define l_conn_encrypted l_unsupported
+#define l_conn_close l_unsupported
+
+#endif
+
+static const struct luaL_Reg shmconnmethods[] = {
+    {"read", l_conn_read},
+    {"write", l_conn_write},
+    {"wait_readable", l_conn_wait_readable},
+    {"wait_writable", l_conn_wait_writable},
+    {"encrypted", l_conn_encrypted},
+    {"close", l_conn_close},
+    {NULL, NULL}};
+
+static const struct luaL_Reg shmlistenermethods[] = {
+    {"accept", l_listener_accept},
+    {"close", l_listener_close},
+    {NULL, NULL}};
+
+static const struct luaL_Reg luadtpshmcorelib[] = {
+    {"listen", l_listen},
+    {"connect", l_connect},
+    {"supported", l_supported},
+    {NULL, NULL}};
+
+/**
+ * Register a metatable whose methods are looked up in itself and which closes its object when collected.
+ *
+ * @param L The Lua state.
+ * @param name The metatable name.
+ * @param methods The methods of the type.
+ * @param gc The function that closes an object of the type.
+ */
+static void register_type(lua_State *L, const char *name, const struct luaL_Reg *methods, lua_CFunction gc)
+{
+    luaL_newmetatable(L, name);
+    luaL_setfuncs(L, methods, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+}
+
+LUADTPSHMCORE_API int luaopen_luadtp_shmcore(lua_State *L)
+{
+    register_type(L, SHM_CONN_METATABLE, shmconnmethods, l_conn_close);
+    register_type(L, SHM_LISTENER_METATABLE, shmlistenermethods, l_listener_close);
+    luaL_newlib(L, luadtpshmcorelib);
+    return 1;
+}
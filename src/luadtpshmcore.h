@@ -0,0 +1,14 @@
+#ifndef LUADTPSHMCORE_H
+#define LUADTPSHMCORE_H
+
+#include <lua.h>
+
+#ifdef _WIN32
+#define LUADTPSHMCORE_API __declspec(dllexport)
+#else
+#define LUADTPSHMCORE_API __attribute__((visibility("default")))
+#endif
+
+LUADTPSHMCORE_API int luaopen_luadtp_shmcore(lua_State *L);
+
+#endif /* LUADTPSHMCORE_H */
@@ -0,0 +1,114 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.crypto"
+local crypto = require("luadtp.crypto")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+
+-- The size of a routed message's type.
+local typeSize = 2
+
+-- The size of a routed message's routing key.
+local routingKeySize = 4
+
+-- The largest message type.
+local maxType = 65535
+
+-- The largest routing key.
+local maxRoutingKey = 4294967295
+
+---@class Message
+---@field type integer The message type, which can be read without decrypting or deserializing the message.
+---@field routingKey integer The routing key, which can be read without decrypting or deserializing the message.
+---@field _key string? The key the payload is sealed with, or nil if it is not encrypted.
+---@field _header string The encoded header.
+---@field _payload string The payload as received.
+---@field _plaintext Buffer? The decrypted payload, once the message has been opened.
+---@field _data any The deserialized data, once the message has been deserialized.
+---@field _deserialized boolean Whether the message has been deserialized.
+local Message = {}
+Message.__index = Message
+
+---Validates an integer header field.
+---@param value integer The field's value.
+---@param max integer The field's largest value.
+---@param name string The field's name, for error messages.
+local function checkField(value, max, name)
+  if type(value) ~= "number" or value < 0 or value > max or value % 1 ~= 0 then
+    error("invalid " .. name .. ": " .. tostring(value))
+  end
+end
+
+---Encodes the header of a routed message.
+---@param messageType integer The message type, from 0 to 65535.
+---@param routingKey integer The routing key, from 0 to 4294967295.
+---@return string # The encoded header.
+local function encodeHeader(messageType, routingKey)
+  checkField(messageType, maxType, "message type")
+  checkField(routingKey, maxRoutingKey, "routing key")
+
+  return util.encodeInteger(messageType, typeSize) .. util.encodeInteger(routingKey, routingKeySize)
+end
+
+---Derives the key routed messages are sealed with from a connection's AES key, so that the two ciphers never share a key.
+---@param key string The connection's AES key.
+---@return string # The routed message key.
+local function deriveKey(key)
+  return crypto.hmacSha256(key, "luadtp routed")
+end
+
+---Wraps a received routed message. Nothing is authenticated, decrypted or deserialized until the data is requested.
+---@param key string? The key the payload is sealed with, or nil if it is not encrypted.
+---@param header string The encoded header.
+---@param payload string The payload as received.
+---@return Message
+function Message.new(key, header, payload)
+  local message = setmetatable({
+    type = util.decodeInteger(header, 1, typeSize),
+    routingKey = util.decodeInteger(header, typeSize + 1, routingKeySize),
+    _key = key,
+    _header = header,
+    _payload = payload,
+    _plaintext = nil,
+    _data = nil,
+    _deserialized = false,
+  }, Message)
+
+  return message
+end
+
+---Authenticates the payload and header together and decrypts the payload into a buffer, if this has not been done yet. The buffer can be relayed to other connections entirely in native code.
+---@return Buffer # The decrypted payload.
+function Message:_open()
+  if self._plaintext == nil then
+    local plaintext = self._payload
+
+    if self._key ~= nil then
+      plaintext = frame.openSealed(self._key, self._header, self._payload)
+      if plaintext == nil then
+        error("routed message could not be authenticated")
+      end
+    end
+
+    self._plaintext = crypto.newBuffer(plaintext)
+  end
+
+  return self._plaintext
+end
+
+---Returns the message's data, decrypting and deserializing it on first use. Messages that are only routed or dropped never need to be.
+---@return any
+function Message:data()
+  if not self._deserialized then
+    self._data = util.deserialize(self:_open():sub())
+    self._deserialized = true
+  end
+
+  return self._data
+end
+
+return {
+  Message = Message,
+  encodeHeader = encodeHeader,
+  deriveKey = deriveKey,
+}
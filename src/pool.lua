@@ -0,0 +1,393 @@
+---@module "src.client"
+local clientImpl = require("luadtp.client")
+---@module "src.reactor"
+local reactor = require("luadtp.reactor")
+local socket = require("socket")
+
+-- The number of seconds a connection and its key exchange may take, unless configured otherwise.
+local defaultConnectTimeout = 5
+
+-- The number of seconds to wait before replacing a failed connection, unless configured otherwise.
+local defaultReconnectDelay = 0.1
+
+-- The longest delay between attempts to replace a failed connection, in seconds. The delay doubles after each failed attempt until it reaches this.
+local maxReconnectDelay = 10
+
+-- The ways of picking the connection each message is sent on.
+local strategies = {
+  leastOutstanding = "leastOutstanding",
+  roundRobin = "roundRobin",
+}
+
+---@class PoolEndpoint
+---@field host string The server host address.
+---@field port integer? The server port.
+
+---@class PoolOptions
+---@field size integer? The number of connections to keep open, spread evenly over the endpoints. Defaults to one per endpoint.
+---@field strategy string? How to pick the connection each message is sent on: "leastOutstanding" picks the connection with the fewest outstanding bytes, and "roundRobin" takes turns. Defaults to "leastOutstanding". Only the requests of calls awaiting a response stay outstanding, since `send`, `sendRaw` and `sendRouted` write their frames immediately, so "leastOutstanding" balances calls, and plain sends take turns among the connections with the fewest.
+---@field connectTimeout number? The number of seconds a connection and its key exchange may take before the attempt is abandoned. Defaults to 5.
+---@field reconnectDelay number? The number of seconds to wait before replacing a failed connection. Defaults to 0.1.
+
+---@class PoolConnection
+---@field endpoint PoolEndpoint The endpoint the connection is made to.
+---@field client Client? The client, which may still be connecting, or nil while the connection is waiting to be replaced.
+---@field co thread? The client's coroutine, once the client is connected.
+---@field deadline number? The time by which the client must be connected, while it is connecting.
+---@field retryAt number The time at which to next try to replace the connection.
+---@field retryDelay number The number of seconds to wait if the next attempt to replace the connection fails.
+
+---@class Pool
+---@field _endpoints PoolEndpoint[] The endpoints connections are made to.
+---@field _size integer The number of connections to keep open.
+---@field _strategy string How to pick the connection each message is sent on.
+---@field _connectTimeout number The number of seconds a connection and its key exchange may take.
+---@field _reconnectDelay number The number of seconds to wait before replacing a failed connection.
+---@field _connections PoolConnection[] The connections.
+---@field _cursor integer The index of the connection picked most recently.
+---@field _isConnected boolean Whether the pool is connected.
+local Pool = {}
+Pool.__index = Pool
+
+---Abandons a connection attempt and schedules the next one, doubling the delay after each failed attempt.
+---@param connection PoolConnection The connection.
+local function backOff(connection)
+  connection.client = nil
+  connection.co = nil
+  connection.deadline = nil
+  connection.retryAt = socket.gettime() + connection.retryDelay
+  connection.retryDelay = math.min(connection.retryDelay * 2, maxReconnectDelay)
+end
+
+---Starts opening a connection with a new client, without blocking. If it cannot even be started, the next attempt is scheduled.
+---@param pool Pool The connection pool.
+---@param connection PoolConnection The connection.
+---@return string? # An error message, if the connection failed.
+local function open(pool, connection)
+  local client = clientImpl.Client.new()
+  local ok, err = pcall(client._beginConnect, client, connection.endpoint.host, connection.endpoint.port, pool._connectTimeout)
+
+  if not ok then
+    backOff(connection)
+    return err
+  end
+
+  connection.client = client
+  connection.deadline = socket.gettime() + pool._connectTimeout
+  return nil
+end
+
+---Advances a connection that is being opened, and its key exchange, as far as possible without blocking. If it fails or runs out of time, the next attempt is scheduled.
+---@param pool Pool The connection pool.
+---@param connection PoolConnection The connection.
+---@return boolean # Whether the connection is open.
+---@return string? # An error message, if the connection failed.
+local function advance(pool, connection)
+  local client = connection.client
+  local ok, co = pcall(client._continueConnect, client)
+
+  if ok and co ~= nil then
+    connection.co = co
+    connection.deadline = nil
+    connection.retryDelay = pool._reconnectDelay
+    return true, nil
+  end
+
+  if ok then
+    if socket.gettime() < connection.deadline then
+      return false, nil
+    end
+
+    client:disconnect()
+    co = "client socket connect error: timeout"
+  end
+
+  backOff(connection)
+  return false, co
+end
+
+---Marks a connection as failed, so that it is replaced once the reconnect delay has elapsed.
+---@param pool Pool The connection pool.
+---@param connection PoolConnection The connection.
+local function fail(pool, connection)
+  connection.client = nil
+  connection.co = nil
+  connection.retryAt = socket.gettime() + connection.retryDelay
+end
+
+---Picks the connected client the next message is sent on. Clients are scanned starting after the one picked most recently, so that clients with equal outstanding bytes take turns. Plain sends never leave bytes outstanding, so between calls this is the same as taking turns.
+---@param pool Pool The connection pool.
+---@return Client # The client.
+local function pick(pool)
+  if not pool._isConnected then
+    error("pool is not connected")
+  end
+
+  local connections = pool._connections
+  local count = #connections
+  local best, bestIndex, bestBytes = nil, nil, nil
+
+  for i = 1, count do
+    local index = (pool._cursor + i - 1) % count + 1
+    local client = connections[index].client
+
+    if client ~= nil and client:connected() then
+      if pool._strategy == strategies.roundRobin then
+        best, bestIndex = client, index
+        break
+      end
+
+      local bytes = client:outstandingBytes()
+      if best == nil or bytes < bestBytes then
+        best, bestIndex, bestBytes = client, index, bytes
+      end
+    end
+  end
+
+  if best == nil then
+    error("pool has no open connections")
+  end
+
+  pool._cursor = bestIndex
+  return best
+end
+
+---Performs a single polling and event-triggering cycle for every connection, and replaces failed connections whose reconnect delay has elapsed. Replacement connections are opened without blocking, so a slow or unreachable endpoint never stalls the other connections.
+---@param pool Pool The connection pool.
+local function handle(pool)
+  while pool._isConnected do
+    local now = socket.gettime()
+
+    for i, connection in ipairs(pool._connections) do
+      if connection.co ~= nil then
+        local co = connection.co
+
+        repeat
+          local ok, event = coroutine.resume(co)
+          if not ok then
+            error(event, 0)
+          end
+
+          if event ~= nil then
+            event.connection = i
+            coroutine.yield(event)
+          end
+        until event == nil or coroutine.status(co) == "dead"
+
+        if pool._isConnected and (coroutine.status(co) == "dead" or not connection.client:connected()) then
+          fail(pool, connection)
+        end
+      elseif connection.client ~= nil then
+        if advance(pool, connection) then
+          coroutine.yield({ eventType = "reconnected", connection = i })
+        end
+      elseif pool._isConnected and now >= connection.retryAt then
+        open(pool, connection)
+      end
+    end
+
+    coroutine.yield()
+  end
+end
+
+---Constructs and returns a new connection pool.
+---@param endpoints PoolEndpoint[] The endpoints to connect to.
+---@param options PoolOptions? The pool options.
+---@return Pool
+function Pool.new(endpoints, options)
+  options = options or {}
+
+  if #endpoints == 0 then
+    error("pool requires at least one endpoint")
+  end
+
+  local strategy = options.strategy or strategies.leastOutstanding
+  if strategies[strategy] == nil then
+    error("invalid pool strategy: " .. tostring(strategy))
+  end
+
+  local size = options.size or #endpoints
+  if size < 1 then
+    error("pool size must be positive")
+  end
+
+  local pool = setmetatable({
+    _endpoints = endpoints,
+    _size = size,
+    _strategy = strategy,
+    _connectTimeout = options.connectTimeout or defaultConnectTimeout,
+    _reconnectDelay = options.reconnectDelay or defaultReconnectDelay,
+    _connections = {},
+    _cursor = 0,
+    _isConnected = false,
+  }, Pool)
+
+  return pool
+end
+
+---Opens every connection in the pool, performing all key exchanges up front so that sending never waits on one. The connections are opened at the same time, and this blocks until each of them is open or has taken longer than the connect timeout. Connections that fail to open, or that fail later, are replaced in the background as the pool is polled, and trigger an event of type "reconnected" once they are. Events from every connection are triggered by the pool's coroutine, with a `connection` field holding the connection's index.
+---@return thread # A coroutine that must be polled to handle pool events.
+function Pool:connect()
+  if self._isConnected then
+    error("pool is already connected")
+  end
+
+  self._connections = {}
+  self._cursor = 0
+  local opened = 0
+  local lastErr = nil
+
+  for i = 1, self._size do
+    local connection = {
+      endpoint = self._endpoints[(i - 1) % #self._endpoints + 1],
+      client = nil,
+      co = nil,
+      deadline = nil,
+      retryAt = 0,
+      retryDelay = self._reconnectDelay,
+    }
+    self._connections[i] = connection
+    lastErr = open(self, connection) or lastErr
+  end
+
+  local connecting = true
+  while connecting do
+    local recvt, sendt = {}, {}
+    local wait = nil
+    connecting = false
+
+    for _, connection in ipairs(self._connections) do
+      if connection.client ~= nil and connection.co == nil then
+        local ok, err = advance(self, connection)
+        if ok then
+          opened = opened + 1
+        elseif err ~= nil then
+          lastErr = err
+        else
+          connecting = true
+          wait = reactor.earliest(wait, connection.client:_watch(recvt, sendt))
+          wait = reactor.earliest(wait, math.max(connection.deadline - socket.gettime(), 0))
+        end
+      end
+    end
+
+    if connecting and wait > 0 then
+      socket.select(recvt, sendt, wait)
+    end
+  end
+
+  if opened == 0 then
+    error("pool connect error: " .. lastErr)
+  end
+
+  self._isConnected = true
+
+  local co = coroutine.create(function ()
+    handle(self)
+  end)
+
+  return co
+end
+
+---Disconnects every connection in the pool.
+function Pool:disconnect()
+  if not self._isConnected then
+    error("pool is not connected")
+  end
+
+  self._isConnected = false
+
+  for _, connection in ipairs(self._connections) do
+    local client = connection.client
+
+    -- Clients that are still connecting are abandoned as well
+    if client ~= nil and (client:connected() or connection.co == nil) then
+      client:disconnect()
+    end
+
+    connection.client = nil
+    connection.co = nil
+    connection.deadline = nil
+  end
+end
+
+---Sends data on one of the pool's connections. Messages sent on different connections may arrive out of order.
+---@param data any The data to send.
+function Pool:send(data)
+  pick(self):send(data)
+end
+
+---Sends raw bytes on one of the pool's connections, skipping serialization.
+---@param data string|Buffer The bytes to send.
+function Pool:sendRaw(data)
+  pick(self):sendRaw(data)
+end
+
+---Sends data with a routing header on one of the pool's connections.
+---@param messageType integer The message type, from 0 to 65535.
+---@param routingKey integer The routing key, from 0 to 4294967295.
+---@param data any The data to send.
+function Pool:sendRouted(messageType, routingKey, data)
+  pick(self):sendRouted(messageType, routingKey, data)
+end
+
+---Calls a procedure registered on the server with `server:handle`, on one of the pool's connections. The call fails if its connection fails before the response arrives.
+---@param method string The method name.
+---@param args any The arguments to pass to the handler.
+---@param timeout number? The number of seconds to wait for a response, or nil to wait indefinitely.
+---@return Call # The pending call.
+function Pool:call(method, args, timeout)
+  return pick(self):call(method, args, timeout)
+end
+
+---Is the pool connected?
+---@return boolean
+function Pool:connected()
+  return self._isConnected
+end
+
+---Returns the number of the pool's connections that are currently open.
+---@return integer
+function Pool:openCount()
+  local count = 0
+
+  for _, connection in ipairs(self._connections) do
+    if connection.client ~= nil and connection.client:connected() then
+      count = count + 1
+    end
+  end
+
+  return count
+end
+
+---Adds the sockets of the pool's connections to the sets passed to `socket.select`, for a reactor driving the pool.
+---@param recvt table The sockets to wait on for reading.
+---@param sendt table The sockets to wait on for writing.
+---@return number? # How long until the pool must be polled regardless, or nil if it only needs polling once one of its sockets is ready.
+function Pool:_watch(recvt, sendt)
+  if not self._isConnected then
+    return 0
+  end
+
+  local delay = nil
+  local now = socket.gettime()
+
+  for _, connection in ipairs(self._connections) do
+    if connection.client ~= nil then
+      delay = reactor.earliest(delay, connection.client:_watch(recvt, sendt))
+
+      if connection.deadline ~= nil then
+        delay = reactor.earliest(delay, math.max(connection.deadline - now, 0))
+      end
+    else
+      delay = reactor.earliest(delay, math.max(connection.retryAt - now, 0))
+    end
+  end
+
+  return delay
+end
+
+return {
+  Pool = Pool,
+  strategies = strategies,
+}
@@ -0,0 +1,176 @@
+local socket = require("socket")
+
+-- How often instances with connections that cannot be waited on, such as shared memory connections, are polled, in seconds.
+local unselectablePollInterval = 0.001
+
+---@class ReactorEntry
+---@field instance Client|Server The registered client or server.
+---@field co thread The instance's event coroutine.
+---@field deadline number? The time by which the instance must be polled, even if none of its sockets are ready.
+---@field ready boolean Whether one of the instance's sockets is ready.
+
+---@class Reactor
+---@field _entries ReactorEntry[] The registered instances, in the order they were added.
+local Reactor = {}
+Reactor.__index = Reactor
+
+---Adds a socket to a set of sockets to wait on.
+---@param sock table The socket.
+---@param set table The set of sockets.
+---@return number? # How long until the socket's owner must be polled regardless: 0 if the socket has buffered data, the polling interval if the socket cannot be waited on, and nil otherwise.
+local function watch(sock, set)
+  if sock.getfd == nil then
+    return unselectablePollInterval
+  end
+
+  set[#set + 1] = sock
+
+  if sock.dirty ~= nil and sock:dirty() then
+    return 0
+  end
+
+  return nil
+end
+
+---Returns the earlier of two optional delays.
+---@param a number? The first delay.
+---@param b number? The second delay.
+---@return number? # The earlier delay, or nil if neither is given.
+local function earliest(a, b)
+  if a == nil then
+    return b
+  elseif b == nil then
+    return a
+  end
+
+  return math.min(a, b)
+end
+
+---Constructs and returns a new reactor.
+---@return Reactor
+function Reactor.new()
+  local reactor = setmetatable({
+    _entries = {},
+  }, Reactor)
+
+  return reactor
+end
+
+---Registers a client or server with the reactor, which then polls its event coroutine whenever it has something to do.
+---@param instance Client|Server The client or server.
+---@param co thread The coroutine returned by `client:connect` or `server:start`.
+function Reactor:add(instance, co)
+  self._entries[#self._entries + 1] = {
+    instance = instance,
+    co = co,
+    deadline = nil,
+    ready = false,
+  }
+end
+
+---Unregisters a client or server. Instances are unregistered automatically once they disconnect or stop.
+---@param instance Client|Server The client or server.
+function Reactor:remove(instance)
+  for i, entry in ipairs(self._entries) do
+    if entry.instance == instance then
+      table.remove(self._entries, i)
+      return
+    end
+  end
+end
+
+---Returns the number of registered instances.
+---@return integer
+function Reactor:count()
+  return #self._entries
+end
+
+---Waits until at least one registered instance has something to do, or a timeout elapses, and polls every instance that does. The sockets of all instances are waited on with a single `socket.select` call, so idle instances cost nothing. Instances whose connections cannot be waited on, such as shared memory connections, are polled every millisecond.
+---@param timeout number? The longest time to wait, in seconds, or nil to wait indefinitely.
+---@return table[] # The events triggered by the instances, each with a `source` field holding the instance that triggered it.
+function Reactor:poll(timeout)
+  local recvt, sendt, owners = {}, {}, {}
+  local wait = timeout
+  local now = socket.gettime()
+
+  for _, entry in ipairs(self._entries) do
+    local recvCount, sendCount = #recvt, #sendt
+    local delay = entry.instance:_watch(recvt, sendt)
+
+    for i = recvCount + 1, #recvt do
+      owners[recvt[i]] = entry
+    end
+
+    for i = sendCount + 1, #sendt do
+      owners[sendt[i]] = entry
+    end
+
+    entry.deadline = delay ~= nil and now + delay or nil
+    entry.ready = false
+    wait = earliest(wait, delay)
+  end
+
+  if #self._entries == 0 then
+    return {}
+  end
+
+  -- Readiness is collected even when an instance must be polled right away, so that a busy instance cannot starve the others
+  local readable, writable, err = socket.select(recvt, sendt, wait)
+  if err ~= nil and err ~= "timeout" then
+    error("reactor select error: " .. err)
+  end
+
+  for _, sock in ipairs(readable) do
+    owners[sock].ready = true
+  end
+
+  for _, sock in ipairs(writable) do
+    owners[sock].ready = true
+  end
+
+  now = socket.gettime()
+  local events = {}
+  local i = 1
+
+  while i <= #self._entries do
+    local entry = self._entries[i]
+
+    if entry.ready or (entry.deadline ~= nil and entry.deadline <= now) then
+      repeat
+        local ok, event = coroutine.resume(entry.co)
+        if not ok then
+          error(event, 0)
+        end
+
+        if event ~= nil then
+          event.source = entry.instance
+          events[#events + 1] = event
+        end
+      until event == nil or coroutine.status(entry.co) == "dead"
+    end
+
+    if coroutine.status(entry.co) == "dead" then
+      table.remove(self._entries, i)
+    else
+      i = i + 1
+    end
+  end
+
+  return events
+end
+
+---Polls the registered instances until none remain, passing every event to a handler.
+---@param handler fun(event: table) The event handler. Each event has a `source` field holding the instance that triggered it.
+function Reactor:run(handler)
+  while #self._entries > 0 do
+    for _, event in ipairs(self:poll()) do
+      handler(event)
+    end
+  end
+end
+
+return {
+  Reactor = Reactor,
+  watch = watch,
+  earliest = earliest,
+}
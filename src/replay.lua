@@ -0,0 +1,223 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+---@module "src.capture"
+local capture = require("luadtp.capture")
+---@module "src.client"
+local clientImpl = require("luadtp.client")
+local socket = require("socket")
+
+-- The number of seconds a replayed call waits for its response by default.
+local defaultCallTimeout = 10
+
+-- The longest the replay sleeps while waiting for the next record to become due, in seconds.
+local maxIdleSleep = 0.001
+
+-- The largest number of records applied before the simulated clients are polled again. This keeps a replay running as fast as possible, or behind schedule, from writing more than the clients' sockets can take in one go.
+local maxRecordsPerCycle = 64
+
+---@class ReplayOptions
+---@field speed number? How many times faster than the original pace to replay the traffic. 0 replays it as fast as possible. Defaults to 1.
+---@field callTimeout number? The number of seconds a replayed call waits for its response. Defaults to 10.
+
+---@class ReplayLatency
+---@field count integer The number of completed calls.
+---@field failed integer The number of calls that failed or timed out.
+---@field mean number The mean call latency, in seconds.
+---@field p50 number The median call latency, in seconds.
+---@field p99 number The 99th percentile call latency, in seconds.
+---@field max number The highest call latency, in seconds.
+
+---@class ReplayReport
+---@field clients integer The number of simulated clients.
+---@field messages integer The number of frames sent.
+---@field bytes integer The number of payload bytes sent.
+---@field duration number The number of seconds the replay took.
+---@field messagesPerSecond number The rate at which frames were sent.
+---@field bytesPerSecond number The rate at which payload bytes were sent.
+---@field meanLag number How far behind schedule records were replayed on average, in seconds. A growing lag means the server is not keeping up.
+---@field maxLag number How far behind schedule the latest record was replayed, in seconds.
+---@field latency ReplayLatency The round-trip latencies of replayed calls.
+
+---@class ReplayClient
+---@field client Client The simulated client.
+---@field co thread The simulated client's coroutine.
+---@field pending integer The number of the client's calls that are awaiting a response.
+---@field closing boolean Whether the client disconnects once its calls have completed.
+
+---Returns a percentile of a sorted list of samples.
+---@param sorted number[] The sorted samples.
+---@param fraction number The percentile, between 0 and 1.
+---@return number
+local function percentile(sorted, fraction)
+  if #sorted == 0 then
+    return 0
+  end
+
+  return sorted[math.max(math.ceil(#sorted * fraction), 1)]
+end
+
+---Replays a capture recorded with `server:startCapture` against a server. Every client in the capture is simulated by its own connection, which connects, sends its frames and disconnects at the original pace, scaled by the speed option. Calls are re-issued as calls, so that their round-trip latency can be measured.
+---@param path string The path of the capture file.
+---@param host string The server host address.
+---@param port integer? The server port.
+---@param options ReplayOptions? The replay options.
+---@return ReplayReport # The throughput and latency of the replay.
+local function run(path, host, port, options)
+  options = options or {}
+  local speed = options.speed or 1
+  local callTimeout = options.callTimeout or defaultCallTimeout
+
+  local nextRecord = capture.records(path)
+  local record = nextRecord()
+  ---@type { [integer]: ReplayClient }
+  local clients = {}
+  local calls = {}
+  local latencies = {}
+  local failedCalls = 0
+  local clientCount, messages, bytes = 0, 0, 0
+  local totalLag, maxLag, lagSamples = 0, 0, 0
+
+  local start = socket.gettime()
+
+  ---Applies a captured record.
+  ---@param rec CaptureRecord The record.
+  local function apply(rec)
+    if rec.type == capture.recordTypes.connect then
+      local client = clientImpl.Client.new()
+      clients[rec.clientId] = { client = client, co = client:connect(host, port), pending = 0, closing = false }
+      clientCount = clientCount + 1
+      return
+    end
+
+    local replayed = clients[rec.clientId]
+    if replayed == nil or replayed.closing then
+      return
+    end
+
+    if rec.type == capture.recordTypes.disconnect then
+      replayed.closing = true
+      return
+    end
+
+    local headerSize = frame.headerSizes[rec.type] or 0
+    local header = string.sub(rec.data, 1, headerSize)
+    local payload = string.sub(rec.data, headerSize + 1)
+
+    if rec.type == frame.kinds.request then
+      local request = util.deserialize(payload)
+      calls[#calls + 1] = {
+        call = replayed.client:call(request[1], request[2], callTimeout),
+        sentAt = socket.gettime(),
+        owner = replayed,
+      }
+      replayed.pending = replayed.pending + 1
+    elseif rec.type == frame.kinds.data or rec.type == frame.kinds.chunk or rec.type == frame.kinds.raw
+      or rec.type == frame.kinds.subscribe or rec.type == frame.kinds.unsubscribe or rec.type == frame.kinds.routed
+      or rec.type == frame.kinds.batch then
+      replayed.client:_sendEncoded(rec.type, payload, header)
+    else
+      -- Pings and pongs are generated by the connections themselves
+      return
+    end
+
+    messages = messages + 1
+    bytes = bytes + #payload
+  end
+
+  while record ~= nil or next(clients) ~= nil do
+    local elapsed = socket.gettime() - start
+    local applied = 0
+
+    while record ~= nil and applied < maxRecordsPerCycle and (speed == 0 or record.time / speed <= elapsed) do
+      if speed ~= 0 then
+        local lag = elapsed - record.time / speed
+        totalLag = totalLag + lag
+        maxLag = math.max(maxLag, lag)
+        lagSamples = lagSamples + 1
+      end
+
+      apply(record)
+      record = nextRecord()
+      applied = applied + 1
+    end
+
+    if record == nil then
+      -- Clients still connected when the capture stopped are disconnected once the traffic runs out
+      for _, replayed in pairs(clients) do
+        replayed.closing = true
+      end
+    end
+
+    for clientId, replayed in pairs(clients) do
+      coroutine.resume(replayed.co)
+
+      if replayed.closing and replayed.pending == 0 and replayed.client:connected() then
+        replayed.client:disconnect()
+        coroutine.resume(replayed.co)
+      end
+
+      if coroutine.status(replayed.co) == "dead" then
+        clients[clientId] = nil
+      end
+    end
+
+    local i = 1
+    while i <= #calls do
+      local pendingCall = calls[i]
+
+      if pendingCall.call:done() then
+        if pendingCall.call:result() then
+          latencies[#latencies + 1] = socket.gettime() - pendingCall.sentAt
+        else
+          failedCalls = failedCalls + 1
+        end
+
+        pendingCall.owner.pending = pendingCall.owner.pending - 1
+        calls[i] = calls[#calls]
+        calls[#calls] = nil
+      else
+        i = i + 1
+      end
+    end
+
+    if speed ~= 0 and record ~= nil and #calls == 0 then
+      local wait = record.time / speed - (socket.gettime() - start)
+      if wait > 0 then
+        socket.sleep(math.min(wait, maxIdleSleep))
+      end
+    end
+  end
+
+  local duration = socket.gettime() - start
+  table.sort(latencies)
+  local totalLatency = 0
+
+  for _, latency in ipairs(latencies) do
+    totalLatency = totalLatency + latency
+  end
+
+  return {
+    clients = clientCount,
+    messages = messages,
+    bytes = bytes,
+    duration = duration,
+    messagesPerSecond = duration > 0 and messages / duration or 0,
+    bytesPerSecond = duration > 0 and bytes / duration or 0,
+    meanLag = lagSamples > 0 and totalLag / lagSamples or 0,
+    maxLag = maxLag,
+    latency = {
+      count = #latencies,
+      failed = failedCalls,
+      mean = #latencies > 0 and totalLatency / #latencies or 0,
+      p50 = percentile(latencies, 0.5),
+      p99 = percentile(latencies, 0.99),
+      max = latencies[#latencies] or 0,
+    },
+  }
+end
+
+return {
+  run = run,
+}
@@ -0,0 +1,83 @@
+-- The size of a call's correlation ID.
+local callIdSize = 4
+
+-- The largest correlation ID, after which IDs wrap around.
+local maxCallId = 4294967295
+
+---@class Call
+---@field _done boolean Whether the call has completed.
+---@field _ok boolean Whether the call succeeded.
+---@field _value any The call's result, or the error message if it failed.
+---@field _timer Timer? The timer that fails the call once its timeout elapses.
+---@field _size integer The size of the call's request.
+local Call = {}
+Call.__index = Call
+
+---Constructs and returns a new pending call.
+---@return Call
+function Call.new()
+  local call = setmetatable({
+    _done = false,
+    _ok = false,
+    _value = nil,
+    _timer = nil,
+    _size = 0,
+  }, Call)
+
+  return call
+end
+
+---Completes the call. Completing an already completed call has no effect.
+---@param ok boolean Whether the call succeeded.
+---@param value any The call's result, or the error message if it failed.
+function Call:_complete(ok, value)
+  if self._done then
+    return
+  end
+
+  self._done = true
+  self._ok = ok
+  self._value = value
+
+  if self._timer ~= nil then
+    self._timer:cancel()
+    self._timer = nil
+  end
+end
+
+---Has the call completed, either successfully or not?
+---@return boolean
+function Call:done()
+  return self._done
+end
+
+---Returns the outcome of a completed call.
+---@return boolean # Whether the call succeeded.
+---@return any # The call's result, or the error message if it failed.
+function Call:result()
+  if not self._done then
+    error("call has not completed")
+  end
+
+  return self._ok, self._value
+end
+
+---Yields the calling coroutine until the call completes, then returns its result. Errors are raised. The client's own coroutine must keep being polled for the call to complete.
+---@return any # The call's result.
+function Call:await()
+  while not self._done do
+    coroutine.yield()
+  end
+
+  if not self._ok then
+    error(self._value)
+  end
+
+  return self._value
+end
+
+return {
+  Call = Call,
+  callIdSize = callIdSize,
+  maxCallId = maxCallId,
+}
@@ -2,6 +2,26 @@
 local util = require("luadtp.util")
 ---@module "src.crypto"
 local crypto = require("luadtp.crypto")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+---@module "src.timer"
+local timer = require("luadtp.timer")
+---@module "src.shm"
+local shm = require("luadtp.shm")
+---@module "src.datagram"
+local datagram = require("luadtp.datagram")
+---@module "src.stream"
+local stream = require("luadtp.stream")
+---@module "src.capture"
+local capture = require("luadtp.capture")
+---@module "src.state"
+local stateImpl = require("luadtp.state")
+---@module "src.message"
+local messageImpl = require("luadtp.message")
+---@module "src.batch"
+local batch = require("luadtp.batch")
+---@module "src.reactor"
+local reactor = require("luadtp.reactor")
 local socket = require("socket")
 
 ---@class ServerInner
@@ -10,47 +30,146 @@ local socket = require("socket")
 ---@field settimeout function
 ---@field getsockname function
 
+---@class ServerClient
+---@field conn ClientInner The underlying connection to the client.
+---@field key string? The AES key, or nil if the connection is not encrypted.
+---@field routedKey string? The key routed messages are sealed with, or nil if the connection is not encrypted.
+---@field lastActivity number The time at which the client last sent anything.
+---@field pinged boolean Whether the client has been pinged since it last sent anything.
+---@field idleTimer Timer? The timer for the client's next inactivity check.
+---@field udpToken string? The token identifying the client's datagrams.
+---@field udpKey string? The key the client's datagrams are encrypted with.
+---@field udpSendSeq integer The sequence number of the last datagram sent to the client.
+---@field udpRecvSeq integer The sequence number of the last datagram accepted from the client.
+---@field udpIp string? The address the client's datagrams come from.
+---@field udpPort integer? The port the client's datagrams come from.
+---@field outbox Outbox The stream messages waiting to be sent to the client.
+---@field inbox Inbox The partially received stream messages from the client.
+---@field ip string? The client's IP address, or nil for shared memory connections.
+---@field stateVersions { [string]: integer } The version of each published state the client has been sent, keyed by state name.
+---@field topics { [string]: boolean } The topics the client is subscribed to.
+---@field readSize integer? The size of the frame being received, once its size prefix has been received.
+---@field readPartial string The bytes received so far of the size prefix or frame currently being received.
+---@field readDeficit number The number of bytes the client may still have read before yielding its turn.
+---@field readTokens number The number of bytes the client may currently have read under its rate limit.
+---@field readRefilled number The time at which read tokens were last added.
+---@field orderIndex integer The client's position in the round-robin order.
+---@field batch Batch? The messages waiting to be sent to the client together, while the server is batching.
+
+---@class PendingHandshake
+---@field conn ClientInner The underlying connection to the client.
+---@field ip string? The client's IP address, or nil for shared memory connections.
+---@field privateKey string The RSA private key generated for the key exchange.
+---@field outgoing string? The public key message, until it has been sent completely.
+---@field outgoingOffset integer The index of the first unsent byte of the public key message.
+---@field keySize integer? The size of the encrypted AES key, once it has been received.
+---@field received string The bytes received so far of the field currently being received.
+---@field deadline number? The time by which the key exchange must complete.
+
+---@class AdmissionLimits
+---@field maxPendingHandshakes integer? The largest number of key exchanges that may be in progress at once. Further connections wait in the listen backlog.
+---@field acceptRate number? The average number of connections accepted per second. Further connections wait in the listen backlog.
+---@field acceptBurst integer? The number of connections that may be accepted in quick succession after a quiet period. Defaults to the accept rate, rounded up.
+---@field maxClients integer? The largest number of clients, including those still exchanging keys. Further connections are closed as soon as they are accepted.
+---@field maxClientsPerIp integer? The largest number of clients from a single IP address, including those still exchanging keys. Further connections from the address are closed as soon as they are accepted. Shared memory connections are not limited.
+
+---@class ReadLimits
+---@field framesPerTurn integer? The largest number of frames read from a client on each turn. Defaults to 16.
+---@field bytesPerTurn integer? The number of bytes a client may have read on each turn, carried over in deficit round-robin fashion while the client has more to read. Defaults to 65536.
+---@field bytesPerSecond number? The average number of bytes per second read from each client. Clients over their rate are left unread, so that the transport pushes back on them. Defaults to unlimited.
+---@field burstBytes integer? The number of bytes a client may send in quick succession after a quiet period. Defaults to the rate, rounded up.
+
+---@class PublishedState
+---@field version integer The number of times the state has changed since it was first published.
+---@field snapshot table A copy of the state as of its current version.
+
 ---@class Server
 ---@field _isServing boolean Whether the server is serving.
 ---@field _sock ServerInner The underlying server socket.
----@field _clients { [integer]: { conn: ClientInner, key: string } } The list of connected clients.
+---@field _clients { [integer]: ServerClient } The list of connected clients.
 ---@field _nextClientId integer The next available client identifier.
+---@field _timers TimerWheel The timers driven by the server loop.
+---@field _idleTimeout number? The number of seconds of silence after which a client is disconnected.
+---@field _keepaliveInterval number? The number of seconds of silence after which a client is pinged.
+---@field _handshakeTimeout number? The number of seconds a connecting client has to complete the key exchange.
+---@field _shmEncryption boolean Whether shared memory connections are encrypted.
+---@field _udpEnabled boolean Whether the unreliable datagram channel is enabled.
+---@field _udpSock table? The socket datagrams are exchanged through.
+---@field _udpTokens { [string]: integer } The IDs of clients, keyed by their datagram tokens.
+---@field _handlers { [string]: function } The remote procedure handlers, keyed by method name.
+---@field _streamWeights { [integer]: number } The scheduling weights of outgoing streams, keyed by stream ID.
+---@field _rawBuffer Buffer The buffer raw frames are encoded into, which is reused between sends.
+---@field _capture CaptureWriter? The capture that received traffic is being recorded to.
+---@field _states { [string]: PublishedState } The published states, keyed by name.
+---@field _handshakes PendingHandshake[] The key exchanges in progress.
+---@field _admission AdmissionLimits The limits on admitting new connections.
+---@field _acceptTokens number The number of connections that may currently be accepted under the accept rate.
+---@field _acceptRefilled number The time at which accept tokens were last added.
+---@field _clientCount integer The number of connected clients.
+---@field _ipCounts { [string]: integer } The number of clients from each IP address, including those still exchanging keys.
+---@field _topics { [string]: { [integer]: ServerClient } } The subscribers of each topic, keyed by topic and then by client ID.
+---@field _readLimits ReadLimits The limits on reading from each client.
+---@field _clientOrder integer[] The IDs of connected clients, in the order they take turns to be read.
+---@field _readCursor integer The position in the round-robin order of the client that is read first on the next turn.
+---@field _batching boolean Whether messages sent with `send` are being batched.
+---@field _stoppedClients integer[] The IDs of the clients disconnected by `stop`, which are reported once the server loop ends.
 local Server = {}
 Server.__index = Server
 
----Performs a cryptographic key exchange with a connecting client.
----@param server Server The network server.
----@param clientId integer The client's identifier.
----@param conn ClientInner The underlying connection to the client socket.
-local function exchangeKeys(server, clientId, conn)
-  local publicKey, privateKey = crypto.newRsaKeyPair()
-  local publicKeySize = util.encodeMessageSize(#publicKey)
-  local publicKeyBuffer = publicKeySize .. publicKey
-  local n, err = conn:send(publicKeyBuffer)
-  if err ~= nil then
-    error("server socket key exchange error: " .. err)
-  end
+-- The maximum number of datagrams received in a single server cycle.
+local maxDatagramsPerCycle = 64
 
-  if n ~= #publicKeyBuffer then
-    error("server socket did not send all bytes during key exchange (" .. n .. "/" .. #publicKeyBuffer .. ")")
-  end
+-- The largest number of frames read from a client on each turn, unless configured otherwise.
+local defaultFramesPerTurn = 16
 
-  local size, err = conn:receive(util.lenSize)
-  if err ~= nil then
-    error("server key exchange error: " .. err)
-  end
+-- The number of bytes a client may have read on each turn, unless configured otherwise.
+local defaultBytesPerTurn = 65536
 
-  local keySize = util.decodeMessageSize(size)
-  local encryptedKey, err = conn:receive(keySize)
-  if err ~= nil then
-    error("server key exchange error: " .. err)
-  end
+-- The largest encrypted AES key a connecting client may send. Clients announcing a larger key are dropped without reading it.
+local maxEncryptedKeySize = 4096
 
-  local key = crypto.rsaDecrypt(privateKey, encryptedKey)
+---Returns whether a connection must perform a key exchange. Shared memory connections only do so when the server was configured to encrypt them.
+---@param conn ClientInner The underlying connection to the client.
+---@return boolean
+local function requiresKeyExchange(conn)
+  return getmetatable(conn) ~= shm.ShmConnection or conn:encrypted()
+end
+
+---Registers a newly connected client.
+---@param server Server The network server.
+---@param clientId integer The client's identifier.
+---@param conn ClientInner The underlying connection to the client.
+---@param key string? The AES key, or nil if the connection is not encrypted.
+---@param ip string? The client's IP address, or nil for shared memory connections.
+local function addClient(server, clientId, conn, key, ip)
+  server._clientCount = server._clientCount + 1
   server._clients[clientId] = {
     conn = conn,
     key = key,
+    routedKey = key and messageImpl.deriveKey(key),
+    lastActivity = socket.gettime(),
+    pinged = false,
+    idleTimer = nil,
+    udpToken = nil,
+    udpKey = nil,
+    udpSendSeq = 0,
+    udpRecvSeq = 0,
+    udpIp = nil,
+    udpPort = nil,
+    outbox = stream.Outbox.new(conn, key, server._streamWeights),
+    inbox = stream.Inbox.new(),
+    stateVersions = {},
+    ip = ip,
+    topics = {},
+    readSize = nil,
+    readPartial = "",
+    readDeficit = 0,
+    readTokens = server._readLimits.burstBytes or math.ceil(server._readLimits.bytesPerSecond or 0),
+    readRefilled = socket.gettime(),
+    orderIndex = #server._clientOrder + 1,
+    batch = nil,
   }
+  server._clientOrder[#server._clientOrder + 1] = clientId
 end
 
 ---Returns the next available client ID.
@@ -62,28 +181,641 @@ local function newClientId(server)
   return clientId
 end
 
----Performs a single polling and event-triggering cycle for a given client.
+---Subscribes a client to a topic.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+---@param topic string The topic.
+local function subscribeClient(server, clientId, topic)
+  local client = server._clients[clientId]
+  local subscribers = server._topics[topic]
+
+  if subscribers == nil then
+    subscribers = {}
+    server._topics[topic] = subscribers
+  end
+
+  subscribers[clientId] = client
+  client.topics[topic] = true
+end
+
+---Unsubscribes a client from a topic. Topics without subscribers are forgotten.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+---@param topic string The topic.
+local function unsubscribeClient(server, clientId, topic)
+  local subscribers = server._topics[topic]
+  if subscribers == nil then
+    return
+  end
+
+  subscribers[clientId] = nil
+  server._clients[clientId].topics[topic] = nil
+
+  if next(subscribers) == nil then
+    server._topics[topic] = nil
+  end
+end
+
+---Forgets about a connection from an IP address, once it has been closed.
+---@param server Server The network server.
+---@param ip string? The IP address, or nil for shared memory connections.
+local function releaseIp(server, ip)
+  if ip == nil then
+    return
+  end
+
+  local count = server._ipCounts[ip] - 1
+  server._ipCounts[ip] = count > 0 and count or nil
+end
+
+---Closes a client connection and forgets about the client.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+local function releaseClient(server, clientId)
+  local client = server._clients[clientId]
+  client.conn:close()
+
+  if client.idleTimer ~= nil then
+    client.idleTimer:cancel()
+  end
+
+  if client.udpToken ~= nil then
+    server._udpTokens[client.udpToken] = nil
+  end
+
+  if server._capture ~= nil then
+    server._capture:record(clientId, capture.recordTypes.disconnect)
+  end
+
+  for topic, _ in pairs(client.topics) do
+    unsubscribeClient(server, clientId, topic)
+  end
+
+  -- Move the last client in the round-robin order into the released client's place
+  local lastId = server._clientOrder[#server._clientOrder]
+  server._clientOrder[client.orderIndex] = lastId
+  server._clients[lastId].orderIndex = client.orderIndex
+  server._clientOrder[#server._clientOrder] = nil
+
+  releaseIp(server, client.ip)
+  server._clientCount = server._clientCount - 1
+  server._clients[clientId] = nil
+end
+
+---Closes a client connection and reports the disconnection.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+local function dropClient(server, clientId)
+  releaseClient(server, clientId)
+  coroutine.yield({ eventType = "disconnect", clientId = clientId })
+end
+
+local checkIdle
+
+---Schedules the next inactivity check for a client, if any inactivity handling is configured.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+local function scheduleIdleCheck(server, clientId)
+  local client = server._clients[clientId]
+  local idle = socket.gettime() - client.lastActivity
+  local delay = nil
+
+  if server._idleTimeout ~= nil then
+    delay = server._idleTimeout - idle
+  end
+
+  if server._keepaliveInterval ~= nil and not client.pinged then
+    local pingDelay = server._keepaliveInterval - idle
+    if delay == nil or pingDelay < delay then
+      delay = pingDelay
+    end
+  end
+
+  if delay ~= nil then
+    client.idleTimer = server._timers:schedule(math.max(delay, 0), function ()
+      checkIdle(server, clientId)
+    end)
+  end
+end
+
+---Pings or disconnects a client that has been silent for too long.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+checkIdle = function (server, clientId)
+  local client = server._clients[clientId]
+  if client == nil then
+    return
+  end
+
+  client.idleTimer = nil
+  local idle = socket.gettime() - client.lastActivity
+
+  if server._idleTimeout ~= nil and idle >= server._idleTimeout then
+    dropClient(server, clientId)
+    return
+  end
+
+  if server._keepaliveInterval ~= nil and not client.pinged and idle >= server._keepaliveInterval then
+    client.pinged = true
+    client.outbox:send(frame.encode(nil, frame.kinds.ping))
+  end
+
+  scheduleIdleCheck(server, clientId)
+end
+
+---Reschedules the inactivity checks of all connected clients after the configuration has changed.
+---@param server Server The network server.
+local function rescheduleIdleChecks(server)
+  for clientId, client in pairs(server._clients) do
+    if client.idleTimer ~= nil then
+      client.idleTimer:cancel()
+      client.idleTimer = nil
+    end
+
+    scheduleIdleCheck(server, clientId)
+  end
+end
+
+---Sends a frame to a client.
+---@param client ServerClient The client.
+---@param buffer string|Buffer The encoded frame.
+local function sendFrame(client, buffer)
+  local n, err = client.outbox:send(buffer)
+  if err ~= nil then
+    error("server socket send error: " .. err)
+  end
+
+  if n ~= #buffer then
+    error("server socket did not send all bytes (" .. n .. "/" .. #buffer .. ")")
+  end
+end
+
+---Sends a full snapshot of a published state to a client.
+---@param server Server The network server.
+---@param client ServerClient The client.
+---@param name string The state name.
+---@param payload string? The serialized snapshot, if it has already been serialized for another client.
+---@return string # The serialized snapshot.
+local function sendStateSnapshot(server, client, name, payload)
+  local published = server._states[name]
+  payload = payload or util.serialize({ name, published.version, 0, published.snapshot, {} })
+  client.stateVersions[name] = published.version
+  sendFrame(client, frame.encode(client.key, frame.kinds.state, payload))
+  return payload
+end
+
+---Runs the handler for a remote procedure call and sends back its result.
+---@param server Server The network server.
+---@param clientId integer The calling client's ID.
+---@param callId string The encoded correlation ID of the call.
+---@param payload string The serialized method name and arguments.
+local function handleCall(server, clientId, callId, payload)
+  local request = util.deserialize(payload)
+  local handler = server._handlers[request[1]]
+  local ok, value
+
+  if handler == nil then
+    ok, value = false, "unknown method: " .. tostring(request[1])
+  else
+    ok, value = pcall(handler, request[2], clientId)
+    if not ok then
+      value = tostring(value)
+    end
+  end
+
+  local client = server._clients[clientId]
+  if client ~= nil then
+    sendFrame(client, frame.encode(client.key, frame.kinds.response, util.serialize({ ok, value }), callId))
+  end
+end
+
+---Receives part of a frame from a client without blocking. Bytes that arrive before the whole frame has been received are kept for the next attempt.
+---@param client ServerClient The client.
+---@return string? # The frame body, excluding the size prefix, if it has been received completely.
+---@return string? # An error message, if the connection failed or has not received the whole frame yet.
+local function receiveFrame(client)
+  -- LuaSocket counts the bytes passed as a prefix towards the number of bytes to receive
+  if client.readSize == nil then
+    local size, err, partial = client.conn:receive(util.lenSize, client.readPartial)
+    if size == nil then
+      if err == "timeout" and partial ~= nil then
+        client.readPartial = partial
+      end
+
+      return nil, err
+    end
+
+    client.readSize = util.decodeMessageSize(size)
+    client.readPartial = ""
+  end
+
+  local buffer, err, partial = client.conn:receive(client.readSize, client.readPartial)
+  if buffer == nil then
+    if err == "timeout" and partial ~= nil then
+      client.readPartial = partial
+    end
+
+    return nil, err
+  end
+
+  client.readSize = nil
+  client.readPartial = ""
+
+  return buffer, nil
+end
+
+---Handles a frame received from a client.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+---@param buffer string The frame body, excluding the size prefix.
+local function handleFrame(server, clientId, buffer)
+  local client = server._clients[clientId]
+  client.lastActivity = socket.gettime()
+  client.pinged = false
+
+  if client.idleTimer == nil then
+    scheduleIdleCheck(server, clientId)
+  end
+
+  local kind, payload, header = frame.decode(client.key, buffer)
+  if kind == nil then
+    dropClient(server, clientId)
+    return
+  end
+
+  local routed = nil
+
+  if kind == frame.kinds.routed then
+    routed = messageImpl.Message.new(client.routedKey, header, payload)
+  end
+
+  if server._capture ~= nil then
+    local captured = payload
+    if kind == frame.kinds.raw then
+      captured = payload:sub()
+    elseif routed ~= nil then
+      -- Captures hold decrypted traffic so that it can be replayed under another key, which means opening the message
+      local ok, plaintext = pcall(routed._open, routed)
+      if not ok then
+        dropClient(server, clientId)
+        return
+      end
+
+      captured = plaintext:sub()
+    end
+
+    server._capture:record(clientId, kind, header .. captured)
+  end
+
+  if kind == frame.kinds.data then
+    local data = util.deserialize(payload)
+    coroutine.yield({ eventType = "receive", clientId = clientId, data = data })
+  elseif kind == frame.kinds.batch then
+    for message in batch.messages(payload) do
+      coroutine.yield({ eventType = "receive", clientId = clientId, data = util.deserialize(message) })
+
+      if server._clients[clientId] ~= client then
+        return
+      end
+    end
+  elseif routed ~= nil then
+    coroutine.yield({ eventType = "receiveRouted", clientId = clientId, message = routed })
+  elseif kind == frame.kinds.raw then
+    coroutine.yield({ eventType = "receiveRaw", clientId = clientId, data = payload })
+  elseif kind == frame.kinds.chunk then
+    local streamId, message = client.inbox:add(header, payload)
+    if message ~= nil then
+      local data = util.deserialize(message)
+      coroutine.yield({ eventType = "receive", clientId = clientId, data = data, stream = streamId })
+    end
+  elseif kind == frame.kinds.request then
+    handleCall(server, clientId, header, payload)
+  elseif kind == frame.kinds.subscribe or kind == frame.kinds.unsubscribe then
+    local topic = util.deserialize(payload)
+    if type(topic) == "string" then
+      if kind == frame.kinds.subscribe then
+        subscribeClient(server, clientId, topic)
+        coroutine.yield({ eventType = "subscribe", clientId = clientId, topic = topic })
+      elseif client.topics[topic] then
+        unsubscribeClient(server, clientId, topic)
+        coroutine.yield({ eventType = "unsubscribe", clientId = clientId, topic = topic })
+      end
+    end
+  elseif kind == frame.kinds.stateResync then
+    local name = util.deserialize(payload)
+    if server._states[name] ~= nil then
+      sendStateSnapshot(server, client, name)
+    end
+  elseif kind == frame.kinds.ping then
+    client.outbox:send(frame.encode(nil, frame.kinds.pong))
+  end
+end
+
+---Adds the read tokens a client has earned since the last refill, and returns whether it may be read from.
+---@param server Server The network server.
+---@param client ServerClient The client.
+---@return boolean
+local function refillReadTokens(server, client)
+  local rate = server._readLimits.bytesPerSecond
+  if rate == nil then
+    return true
+  end
+
+  local now = socket.gettime()
+  local burst = server._readLimits.burstBytes or math.ceil(rate)
+  client.readTokens = math.min(client.readTokens + (now - client.readRefilled) * rate, burst)
+  client.readRefilled = now
+
+  return client.readTokens > 0
+end
+
+---Performs a single polling and event-triggering cycle for a given client. The client is credited with a quantum of bytes, and frames are read while it has credit left, up to a number of frames per turn. Credit carries over to the next turn only while the client has more to read, so that a client sending a large frame still gets it read promptly, while a client flooding the server gets no more than its share.
 ---@param server Server The network server.
 ---@param clientId integer The client's ID.
 local function serveClient(server, clientId)
   local client = server._clients[clientId]
-  local size, err = client.conn:receive(util.lenSize)
-  if err == nil then
-    local msgSize = util.decodeMessageSize(size)
-    local buffer, err = client.conn:receive(msgSize)
-    if err == nil then
-      local bufferDecrypted = crypto.aesDecrypt(client.key, buffer)
-      local data = util.deserialize(bufferDecrypted)
-      coroutine.yield({ eventType = "receive", clientId = clientId, data = data })
+  if client.outbox:flush() ~= nil then
+    dropClient(server, clientId)
+    return
+  end
+
+  local limits = server._readLimits
+  local bytesPerTurn = limits.bytesPerTurn or defaultBytesPerTurn
+  local framesPerTurn = limits.framesPerTurn or defaultFramesPerTurn
+  client.readDeficit = math.min(client.readDeficit + bytesPerTurn, bytesPerTurn * 2)
+
+  for _ = 1, framesPerTurn do
+    if client.readDeficit <= 0 or not refillReadTokens(server, client) then
+      return
+    end
+
+    local buffer, err = receiveFrame(client)
+    if buffer == nil then
+      if err ~= "timeout" then
+        dropClient(server, clientId)
+      elseif client.readSize == nil and client.readPartial == "" then
+        -- The client has nothing more to read, so it does not keep its credit
+        client.readDeficit = 0
+      end
+
+      return
+    end
+
+    local cost = util.lenSize + #buffer
+    client.readDeficit = client.readDeficit - cost
+    client.readTokens = client.readTokens - cost
+
+    handleFrame(server, clientId, buffer)
+
+    -- Handling the frame may have yielded, during which the client may have been removed
+    if server._clients[clientId] ~= client then
+      return
+    end
+  end
+end
+
+---Gives a newly connected client a token for the datagram channel.
+---@param server Server The network server.
+---@param clientId integer The client's ID.
+local function bindDatagrams(server, clientId)
+  local client = server._clients[clientId]
+  local token = datagram.newToken()
+  client.udpToken = token
+  client.udpKey = datagram.deriveKey(client.key)
+  server._udpTokens[token] = clientId
+  sendFrame(client, frame.encode(client.key, frame.kinds.udpBind, token))
+end
+
+---Receives pending datagrams and triggers events for them.
+---@param server Server The network server.
+local function serveDatagrams(server)
+  for _ = 1, maxDatagramsPerCycle do
+    local packet, ip, port = server._udpSock:receivefrom()
+    if packet == nil then
+      break
+    end
+
+    local clientId = server._udpTokens[datagram.token(packet) or ""]
+    local client = server._clients[clientId or 0]
+
+    if client ~= nil then
+      local seq, payload = datagram.open(client.udpKey, packet, datagram.directions.toServer, client.udpRecvSeq)
+
+      if seq ~= nil then
+        client.udpRecvSeq = seq
+        client.udpIp = ip
+        client.udpPort = port
+        client.lastActivity = socket.gettime()
+        client.pinged = false
+
+        if #payload > 0 then
+          local data = util.deserialize(payload)
+          coroutine.yield({ eventType = "receiveUnreliable", clientId = clientId, data = data })
+        else
+          -- Acknowledge the client's registration so that it stops repeating it
+          client.udpSendSeq = client.udpSendSeq + 1
+          server._udpSock:sendto(datagram.seal(client.udpKey, client.udpToken, datagram.directions.toClient, client.udpSendSeq, ""), ip, port)
+        end
+      end
+    end
+  end
+end
+
+---Registers a client that has completed its key exchange, and reports the connection.
+---@param server Server The network server.
+---@param conn ClientInner The underlying connection to the client.
+---@param key string? The AES key, or nil if the connection is not encrypted.
+---@param ip string? The client's IP address, or nil for shared memory connections.
+local function admitClient(server, conn, key, ip)
+  local clientId = newClientId(server)
+  addClient(server, clientId, conn, key, ip)
+
+  if server._capture ~= nil then
+    server._capture:record(clientId, capture.recordTypes.connect)
+  end
+
+  scheduleIdleCheck(server, clientId)
+
+  if server._udpSock ~= nil and key ~= nil then
+    bindDatagrams(server, clientId)
+  end
+
+  for name, _ in pairs(server._states) do
+    sendStateSnapshot(server, server._clients[clientId], name)
+  end
+
+  coroutine.yield({ eventType = "connect", clientId = clientId })
+end
+
+---Adds the accept tokens earned since the last refill, and returns whether a connection may be accepted.
+---@param server Server The network server.
+---@return boolean
+local function refillAcceptTokens(server)
+  local rate = server._admission.acceptRate
+  if rate == nil then
+    return true
+  end
+
+  local now = socket.gettime()
+  local burst = server._admission.acceptBurst or math.ceil(rate)
+  server._acceptTokens = math.min(server._acceptTokens + (now - server._acceptRefilled) * rate, burst)
+  server._acceptRefilled = now
+
+  return server._acceptTokens >= 1
+end
+
+---Accepts a waiting connection if the admission limits allow it, and starts its key exchange. Connections beyond the pending handshake limit or the accept rate are left in the listen backlog, while those beyond the client limits are closed before any key exchange work is done.
+---@param server Server The network server.
+---@return string? # An error message, if the listening socket failed.
+local function acceptConnection(server)
+  local limits = server._admission
+
+  if limits.maxPendingHandshakes ~= nil and #server._handshakes >= limits.maxPendingHandshakes then
+    return nil
+  end
+
+  if not refillAcceptTokens(server) then
+    return nil
+  end
+
+  local conn, err = server._sock:accept()
+  if err ~= nil then
+    return err ~= "timeout" and err or nil
+  end
+
+  if limits.acceptRate ~= nil then
+    server._acceptTokens = server._acceptTokens - 1
+  end
+
+  local ip = nil
+  if getmetatable(conn) ~= shm.ShmConnection then
+    ip = conn:getpeername()
+  end
+
+  if (limits.maxClients ~= nil and server._clientCount + #server._handshakes >= limits.maxClients)
+    or (ip ~= nil and limits.maxClientsPerIp ~= nil and (server._ipCounts[ip] or 0) >= limits.maxClientsPerIp) then
+    conn:close()
+    return nil
+  end
+
+  if ip ~= nil then
+    server._ipCounts[ip] = (server._ipCounts[ip] or 0) + 1
+  end
+
+  conn:settimeout(0)
+
+  if not requiresKeyExchange(conn) then
+    admitClient(server, conn, nil, ip)
+    return nil
+  end
+
+  local publicKey, privateKey = crypto.newRsaKeyPair()
+  local deadline = nil
+  if server._handshakeTimeout ~= nil then
+    deadline = socket.gettime() + server._handshakeTimeout
+  end
+
+  server._handshakes[#server._handshakes + 1] = {
+    conn = conn,
+    ip = ip,
+    privateKey = privateKey,
+    outgoing = util.encodeMessageSize(#publicKey) .. publicKey,
+    outgoingOffset = 1,
+    keySize = nil,
+    received = "",
+    deadline = deadline,
+  }
+
+  return nil
+end
+
+---Receives a fixed-size field of a key exchange without blocking. Bytes that arrive before the whole field has been received are kept for the next attempt.
+---@param handshake PendingHandshake The key exchange.
+---@param size integer The size of the field.
+---@return string? # The field, if it has been received completely.
+---@return string? # An error message, if the connection failed or has not received the whole field yet.
+local function receiveHandshakeField(handshake, size)
+  -- LuaSocket counts the bytes passed as a prefix towards the number of bytes to receive
+  local data, err, partial = handshake.conn:receive(size, handshake.received)
+  if data ~= nil then
+    handshake.received = ""
+    return data, nil
+  end
+
+  if err == "timeout" and partial ~= nil then
+    handshake.received = partial
+  end
+
+  return nil, err
+end
+
+---Advances a key exchange with a connecting client as far as possible without blocking.
+---@param handshake PendingHandshake The key exchange.
+---@return boolean # Whether the key exchange has finished, successfully or not.
+---@return string? # The AES key, if the key exchange succeeded.
+local function progressHandshake(handshake)
+  if handshake.outgoing ~= nil then
+    local last, err, partial = handshake.conn:send(handshake.outgoing, handshake.outgoingOffset)
+    if last == nil then
+      if err ~= "timeout" then
+        return true, nil
+      end
+
+      handshake.outgoingOffset = partial + 1
+      return false, nil
+    end
+
+    handshake.outgoing = nil
+  end
+
+  if handshake.keySize == nil then
+    local size, err = receiveHandshakeField(handshake, util.lenSize)
+    if size == nil then
+      return err ~= "timeout", nil
+    end
+
+    handshake.keySize = util.decodeMessageSize(size)
+    if handshake.keySize > maxEncryptedKeySize then
+      return true, nil
+    end
+  end
+
+  local encryptedKey, err = receiveHandshakeField(handshake, handshake.keySize)
+  if encryptedKey == nil then
+    return err ~= "timeout", nil
+  end
+
+  local decrypted, key = pcall(crypto.rsaDecrypt, handshake.privateKey, encryptedKey)
+  return true, decrypted and key or nil
+end
+
+---Advances all key exchanges in progress, admitting the clients that have completed theirs and dropping those that failed or ran out of time.
+---@param server Server The network server.
+local function serveHandshakes(server)
+  local now = socket.gettime()
+  local i = 1
+
+  while i <= #server._handshakes do
+    local handshake = server._handshakes[i]
+    local finished, key = progressHandshake(handshake)
+
+    if not finished and handshake.deadline ~= nil and now >= handshake.deadline then
+      finished = true
+    end
+
+    if finished then
+      server._handshakes[i] = server._handshakes[#server._handshakes]
+      server._handshakes[#server._handshakes] = nil
+
+      if key ~= nil then
+        admitClient(server, handshake.conn, key, handshake.ip)
+      else
+        handshake.conn:close()
+        releaseIp(server, handshake.ip)
+      end
     else
-      client.conn:close()
-      server._clients[clientId] = nil
-      coroutine.yield({ eventType = "disconnect", clientId = clientId })
+      i = i + 1
     end
-  elseif err ~= "timeout" then
-    client.conn:close()
-    server._clients[clientId] = nil
-    coroutine.yield({ eventType = "disconnect", clientId = clientId })
   end
 end
 
@@ -91,22 +823,44 @@ end
 ---@param server Server The network server.
 local function serve(server)
   while server._isServing do
-    local conn, err = server._sock:accept()
-    if err == nil then
-      local clientId = newClientId(server)
-      exchangeKeys(server, clientId, conn)
-      conn:settimeout(0)
-      coroutine.yield({ eventType = "connect", clientId = clientId })
-    elseif err ~= "timeout" then
+    server._timers:advance()
+
+    local err = acceptConnection(server)
+    if err ~= nil then
       break
     end
 
-    for clientId, _ in pairs(server._clients) do
-      serveClient(server, clientId)
+    serveHandshakes(server)
+
+    -- Clients take turns in round-robin order, starting from a different client each time
+    local order = server._clientOrder
+    local count = #order
+
+    if count > 0 then
+      server._readCursor = server._readCursor % count + 1
+
+      for i = 0, count - 1 do
+        local clientId = order[(server._readCursor + i - 1) % count + 1]
+
+        if clientId ~= nil and server._clients[clientId] ~= nil then
+          serveClient(server, clientId)
+        end
+      end
+    end
+
+    if server._udpSock ~= nil then
+      serveDatagrams(server)
     end
 
     coroutine.yield()
   end
+
+  local stopped = server._stoppedClients
+  server._stoppedClients = {}
+
+  for _, clientId in ipairs(stopped) do
+    coroutine.yield({ eventType = "disconnect", clientId = clientId })
+  end
 end
 
 ---Constructs and returns a new network server.
@@ -117,26 +871,72 @@ function Server.new()
     _sock = nil,
     _clients = {},
     _nextClientId = 1,
+    _timers = timer.TimerWheel.new(),
+    _idleTimeout = nil,
+    _keepaliveInterval = nil,
+    _handshakeTimeout = nil,
+    _shmEncryption = false,
+    _udpEnabled = false,
+    _udpSock = nil,
+    _udpTokens = {},
+    _handlers = {},
+    _streamWeights = {},
+    _rawBuffer = crypto.newBuffer(),
+    _capture = nil,
+    _states = {},
+    _handshakes = {},
+    _admission = {},
+    _acceptTokens = 0,
+    _acceptRefilled = 0,
+    _clientCount = 0,
+    _ipCounts = {},
+    _topics = {},
+    _readLimits = {},
+    _clientOrder = {},
+    _readCursor = 0,
+    _batching = false,
+    _stoppedClients = {},
   }, Server)
 
   return server
 end
 
----Starts the server listening on a given host and port.
+---Starts the server listening on a given host and port. A host of the form `shm://name` listens for clients on the same machine through shared memory instead, in which case the port is ignored.
 ---@param host string The host address.
----@param port integer The port.
+---@param port integer? The port.
 ---@return thread # A coroutine that must be polled to handle server events. Note that if this is not polled, clients will not be able to connect.
 function Server:start(host, port)
   if self._isServing then
     error("server is already serving")
   end
 
-  local sock, err = socket.bind(host, port)
+  local shmName = shm.parseAddress(host)
+  local sock, err
+  if shmName ~= nil then
+    sock, err = shm.listen(shmName, self._shmEncryption)
+  else
+    sock, err = socket.bind(host, port)
+  end
+
   if err ~= nil then
     error("server socket bind error: " .. err)
   end
 
   sock:setoption("reuseaddr", true)
+
+  if self._udpEnabled and shmName == nil then
+    local boundHost, boundPort = sock:getsockname()
+    local udp = socket.udp()
+    local _, err = udp:setsockname(boundHost, boundPort)
+    if err ~= nil then
+      sock:close()
+      error("server datagram socket bind error: " .. err)
+    end
+
+    udp:settimeout(0)
+    self._udpSock = udp
+  end
+
   self._sock = sock
   self._isServing = true
   self._sock:settimeout(0)
@@ -148,7 +948,7 @@ function Server:start(host, port)
   return co
 end
 
----Stops the server, disconnecting all clients in the process.
+---Stops the server, disconnecting all clients in the process. The disconnections are reported by the server's coroutine before it completes.
 function Server:stop()
   if not self._isServing then
     error("server is not serving")
@@ -156,34 +956,250 @@ function Server:stop()
 
   self._isServing = false
 
-  for _, client in pairs(self._clients) do
-    client.conn:close()
+  for clientId, _ in pairs(self._clients) do
+    releaseClient(self, clientId)
+    self._stoppedClients[#self._stoppedClients + 1] = clientId
+  end
+
+  for _, handshake in ipairs(self._handshakes) do
+    handshake.conn:close()
+  end
+
+  -- A restarted server starts counting admitted clients afresh
+  self._handshakes = {}
+  self._clientCount = 0
+  self._ipCounts = {}
+
+  if self._udpSock ~= nil then
+    self._udpSock:close()
+    self._udpSock = nil
+  end
+
+  if self._capture ~= nil then
+    self._capture:close()
+    self._capture = nil
   end
 
   self._sock:close()
 end
 
+---Sends serialized data to a client, or adds it to the client's batch if the server is batching.
+---@param server Server The network server.
+---@param client ServerClient The client.
+---@param dataSerialized string The serialized data.
+local function sendData(server, client, dataSerialized)
+  if not server._batching then
+    sendFrame(client, frame.encode(client.key, frame.kinds.data, dataSerialized))
+    return
+  end
+
+  if client.batch == nil then
+    client.batch = batch.Batch.new()
+  end
+
+  if client.batch:add(dataSerialized) then
+    sendFrame(client, client.batch:encode(client.key))
+  end
+end
+
 ---Sends data to a set of clients.
 ---@param data any The data to send.
 ---@param clientId integer The ID of the client to send the data to.
 ---@param ... integer Additional IDs of clients to send the data to.
 function Server:send(data, clientId, ...)
-  local clientIds = {...}
-  table.insert(clientIds, 1, clientId)
+  local clientIds = { clientId, ... }
   local dataSerialized = util.serialize(data)
 
   for _, clientId in ipairs(clientIds) do
-    local client = self._clients[clientId]
-    local dataEncrypted = crypto.aesEncrypt(client.key, dataSerialized)
-    local size = util.encodeMessageSize(#dataEncrypted)
-    local buffer = size .. dataEncrypted
-    local n, err = client.conn:send(buffer)
-    if err ~= nil then
-      error("server socket send error: " .. err)
+    sendData(self, self._clients[clientId], dataSerialized)
+  end
+end
+
+---Starts batching messages. Until the batch is flushed, messages sent with `server:send` and `server:sendAll` are held back, and each client's messages are then sent together in a single encrypted frame, which saves the per-frame encryption, padding and system call overhead when sending many small messages. Clients receive them as separate events, in order. Batches that grow large are sent early. Other kinds of messages are not batched, and may arrive before the batched ones.
+function Server:beginBatch()
+  if self._batching then
+    error("server is already batching")
+  end
+
+  self._batching = true
+end
+
+---Sends the messages batched since `server:beginBatch`, and stops batching.
+function Server:flushBatch()
+  if not self._batching then
+    error("server is not batching")
+  end
+
+  self._batching = false
+
+  for _, client in pairs(self._clients) do
+    local pending = client.batch
+    client.batch = nil
+
+    if pending ~= nil and not pending:empty() then
+      sendFrame(client, pending:encode(client.key))
+    end
+  end
+end
+
+---Batches the messages sent by a function, as with `server:beginBatch` and `server:flushBatch`. The batch is flushed even if the function raises an error.
+---@param fn function The function, which is called without arguments.
+function Server:batch(fn)
+  self:beginBatch()
+  local ok, err = pcall(fn)
+  self:flushBatch()
+
+  if not ok then
+    error(err, 0)
+  end
+end
+
+---Publishes the current contents of a keyed table to all clients, who receive it as an event of type "state". Only the fields that changed since the previous publication are sent, and the changes are serialized once for all clients. Clients that have just connected, or that have fallen out of sync, are sent the whole table instead. Call this whenever the table may have changed, e.g. on every tick; nothing is sent if nothing has changed. Fields are compared by value, recursing into tables, and must not contain cycles.
+---@param name string The state name, which lets several states be published independently.
+---@param state table The table to publish.
+function Server:publishState(name, state)
+  local published = self._states[name]
+  local isNew = published == nil
+
+  if isNew then
+    published = { version = 0, snapshot = {} }
+    self._states[name] = published
+  end
+
+  local delta = stateImpl.diff(published.snapshot, state)
+  if delta == nil then
+    if not isNew then
+      return
     end
 
-    if n ~= #buffer then
-      error("server socket did not send all bytes (" .. n .. "/" .. #buffer .. ")")
+    delta = { set = {}, removed = {} }
+  end
+
+  stateImpl.apply(published.snapshot, delta)
+  published.version = published.version + 1
+
+  local deltaPayload = nil
+  local snapshotPayload = nil
+
+  for _, client in pairs(self._clients) do
+    if client.stateVersions[name] == published.version - 1 then
+      deltaPayload = deltaPayload or util.serialize({ name, published.version, published.version - 1, delta.set, delta.removed })
+      client.stateVersions[name] = published.version
+      sendFrame(client, frame.encode(client.key, frame.kinds.state, deltaPayload))
+    else
+      snapshotPayload = sendStateSnapshot(self, client, name, snapshotPayload)
+    end
+  end
+end
+
+---Sends raw bytes to a set of clients, skipping serialization. Clients receive them in a buffer, as an event of type "receiveRaw".
+---@param data string|Buffer The bytes to send.
+---@param clientId integer The ID of the client to send the data to.
+---@param ... integer Additional IDs of clients to send the data to.
+function Server:sendRaw(data, clientId, ...)
+  local clientIds = { clientId, ... }
+
+  for _, clientId in ipairs(clientIds) do
+    local client = self._clients[clientId]
+    sendFrame(client, frame.encodeRaw(client.key, data, self._rawBuffer))
+  end
+end
+
+---Sends data to a set of clients with a routing header. The header carries a message type and a routing key, which are sent unencrypted so that they can be read without decrypting or deserializing the data. Clients receive the data as a message, in an event of type "receiveRouted".
+---@param messageType integer The message type, from 0 to 65535.
+---@param routingKey integer The routing key, from 0 to 4294967295.
+---@param data any The data to send.
+---@param clientId integer The ID of the client to send the data to.
+---@param ... integer Additional IDs of clients to send the data to.
+function Server:sendRouted(messageType, routingKey, data, clientId, ...)
+  local clientIds = { clientId, ... }
+  local header = messageImpl.encodeHeader(messageType, routingKey)
+  local payload = util.serialize(data)
+
+  for _, clientId in ipairs(clientIds) do
+    local client = self._clients[clientId]
+    sendFrame(client, frame.encode(client.routedKey, frame.kinds.routed, payload, header))
+  end
+end
+
+---Relays a received message to a set of clients without deserializing it. The message is decrypted once into a buffer, and each client's frame is encrypted and encoded from that buffer in a single native call, so relaying creates no Lua objects per client beyond the bytes handed to the socket. Raw buffers received in "receiveRaw" events can be relayed the same way with `server:sendRaw`.
+---@param routed Message The message, from a "receiveRouted" event.
+---@param clientId integer The ID of the client to forward the message to.
+---@param ... integer Additional IDs of clients to forward the message to.
+function Server:forward(routed, clientId, ...)
+  local clientIds = { clientId, ... }
+  local payload = routed:_open()
+
+  for _, clientId in ipairs(clientIds) do
+    local client = self._clients[clientId]
+    sendFrame(client, frame.encodeInto(client.routedKey, frame.kinds.routed, payload, routed._header, self._rawBuffer))
+  end
+end
+
+---Relays a received message to every client subscribed to a topic, in the same way as `server:forward`. The sender receives the message too if it is subscribed.
+---@param topic string The topic.
+---@param routed Message The message, from a "receiveRouted" event.
+function Server:forwardToTopic(topic, routed)
+  local subscribers = self._topics[topic]
+  if subscribers == nil then
+    return
+  end
+
+  local payload = routed:_open()
+
+  for _, client in pairs(subscribers) do
+    sendFrame(client, frame.encodeInto(client.routedKey, frame.kinds.routed, payload, routed._header, self._rawBuffer))
+  end
+end
+
+---Queues data to be sent to a set of clients on a logical stream. Stream messages are split into chunks that are interleaved with those of other streams as the server is polled, so a large message does not hold up smaller ones on other streams. Messages on the same stream arrive in order, as events of type "receive" carrying the stream ID. Messages sent with `server:send` bypass the queue entirely.
+---@param streamId integer The stream ID, from 0 to 65535.
+---@param data any The data to send.
+---@param clientId integer The ID of the client to send the data to.
+---@param ... integer Additional IDs of clients to send the data to.
+function Server:sendStream(streamId, data, clientId, ...)
+  stream.checkStreamId(streamId)
+
+  local clientIds = { clientId, ... }
+  local dataSerialized = util.serialize(data)
+
+  for _, clientId in ipairs(clientIds) do
+    self._clients[clientId].outbox:push(streamId, dataSerialized)
+  end
+end
+
+---Sets the scheduling weight of an outgoing stream. When several streams have queued messages, each stream's share of the connection is proportional to its weight. Streams have a weight of 1 by default.
+---@param streamId integer The stream ID, from 0 to 65535.
+---@param weight number The weight, which must be positive.
+function Server:setStreamWeight(streamId, weight)
+  stream.checkStreamId(streamId)
+
+  if weight <= 0 then
+    error("stream weight must be positive")
+  end
+
+  self._streamWeights[streamId] = weight
+end
+
+---Sends data to a set of clients over the unreliable datagram channel. Each message is delivered at most once, may be lost, and is dropped by the receiver if a newer message has already arrived. Clients whose datagram channel has not been established yet are skipped.
+---@param data any The data to send.
+---@param clientId integer The ID of the client to send the data to.
+---@param ... integer Additional IDs of clients to send the data to.
+function Server:sendUnreliable(data, clientId, ...)
+  if self._udpSock == nil then
+    error("server unreliable channel is not enabled")
+  end
+
+  local clientIds = { clientId, ... }
+  local dataSerialized = util.serialize(data)
+
+  for _, clientId in ipairs(clientIds) do
+    local client = self._clients[clientId]
+
+    if client.udpIp ~= nil then
+      client.udpSendSeq = client.udpSendSeq + 1
+      local packet = datagram.seal(client.udpKey, client.udpToken, datagram.directions.toClient, client.udpSendSeq, dataSerialized)
+      self._udpSock:sendto(packet, client.udpIp, client.udpPort)
     end
   end
 end
@@ -191,13 +1207,41 @@ end
 ---Sends data to all connected clients.
 ---@param data any The data to send.
 function Server:sendAll(data)
-  local clientIds = {}
+  local dataSerialized = util.serialize(data)
 
-  for clientId, _ in ipairs(self._clients) do
-    table.insert(clientIds, clientId)
+  for _, client in pairs(self._clients) do
+    sendData(self, client, dataSerialized)
+  end
+end
+
+---Sends data to every client subscribed to a topic, as an event of type "receive" carrying the topic. The data is serialized once, and the subscribers are looked up in an index kept as clients subscribe and unsubscribe, so publishing costs nothing per client beyond encrypting and sending the frame. Publishing to a topic without subscribers does nothing.
+---@param topic string The topic.
+---@param data any The data to send.
+function Server:publish(topic, data)
+  local subscribers = self._topics[topic]
+  if subscribers == nil then
+    return
   end
 
-  self:send(data, table.unpack(clientIds))
+  local payload = util.serialize({ topic, data })
+
+  for _, client in pairs(subscribers) do
+    sendFrame(client, frame.encode(client.key, frame.kinds.publish, payload))
+  end
+end
+
+---Subscribes a client to a topic on its behalf. Clients can also subscribe themselves with `client:subscribe`.
+---@param clientId integer The client's ID.
+---@param topic string The topic.
+function Server:subscribe(clientId, topic)
+  subscribeClient(self, clientId, topic)
+end
+
+---Unsubscribes a client from a topic on its behalf.
+---@param clientId integer The client's ID.
+---@param topic string The topic.
+function Server:unsubscribe(clientId, topic)
+  unsubscribeClient(self, clientId, topic)
 end
 
 ---Is the server currently serving?
@@ -206,6 +1250,58 @@ function Server:serving()
   return self._isServing
 end
 
+---Adds the sockets the server is waiting on to the sets passed to `socket.select`, for a reactor driving it. The listening socket is left out while the admission limits hold back new connections, and so is each client over its read rate, so that neither wakes the reactor until the limit allows it.
+---@param recvt table The sockets to wait on for reading.
+---@param sendt table The sockets to wait on for writing.
+---@return number? # How long until the server must be polled regardless, or nil if it only needs polling once one of its sockets is ready.
+function Server:_watch(recvt, sendt)
+  if not self._isServing then
+    return 0
+  end
+
+  local delay = self._timers:nextDelay()
+  local now = socket.gettime()
+  local limits = self._admission
+
+  if limits.maxPendingHandshakes == nil or #self._handshakes < limits.maxPendingHandshakes then
+    if refillAcceptTokens(self) then
+      delay = reactor.earliest(delay, reactor.watch(self._sock, recvt))
+    else
+      delay = reactor.earliest(delay, (1 - self._acceptTokens) / limits.acceptRate)
+    end
+  end
+
+  for _, handshake in ipairs(self._handshakes) do
+    if handshake.outgoing ~= nil then
+      delay = reactor.earliest(delay, reactor.watch(handshake.conn, sendt))
+    else
+      delay = reactor.earliest(delay, reactor.watch(handshake.conn, recvt))
+    end
+
+    if handshake.deadline ~= nil then
+      delay = reactor.earliest(delay, math.max(handshake.deadline - now, 0))
+    end
+  end
+
+  for _, client in pairs(self._clients) do
+    if client.outbox:pending() then
+      delay = reactor.earliest(delay, reactor.watch(client.conn, sendt))
+    end
+
+    if refillReadTokens(self, client) then
+      delay = reactor.earliest(delay, reactor.watch(client.conn, recvt))
+    else
+      delay = reactor.earliest(delay, -client.readTokens / self._readLimits.bytesPerSecond)
+    end
+  end
+
+  if self._udpSock ~= nil then
+    delay = reactor.earliest(delay, reactor.watch(self._udpSock, recvt))
+  end
+
+  return delay
+end
+
 ---Returns the server's address.
 ---@return string # The server's host address.
 ---@return integer # The server's port.
@@ -246,8 +1342,112 @@ function Server:removeClient(clientId)
     error("server is not serving")
   end
 
-  self._clients[clientId].conn:close()
-  self._clients[clientId] = nil
+  releaseClient(self, clientId)
+end
+
+---Schedules a function to be called once after a delay. The function is called from within the server's coroutine, so the server must be polled for it to fire.
+---@param seconds number The delay, in seconds.
+---@param callback function The function to call.
+---@return Timer # The timer, which can be cancelled.
+function Server:after(seconds, callback)
+  return self._timers:schedule(seconds, callback)
+end
+
+---Schedules a function to be called repeatedly at a given interval. The function is called from within the server's coroutine, so the server must be polled for it to fire.
+---@param seconds number The interval, in seconds.
+---@param callback function The function to call.
+---@return Timer # The timer, which can be cancelled.
+function Server:every(seconds, callback)
+  return self._timers:schedule(seconds, callback, seconds)
+end
+
+---Sets how long a client may remain silent before it is disconnected. Pass nil to never disconnect idle clients.
+---@param seconds number? The idle timeout, in seconds.
+function Server:setIdleTimeout(seconds)
+  self._idleTimeout = seconds
+  rescheduleIdleChecks(self)
+end
+
+---Sets how long a client may remain silent before it is sent a ping. Clients answer pings automatically, so combined with an idle timeout this detects dead peers. Pass nil to disable pings.
+---@param seconds number? The keepalive interval, in seconds.
+function Server:setKeepalive(seconds)
+  self._keepaliveInterval = seconds
+  rescheduleIdleChecks(self)
+end
+
+---Sets whether connections made through shared memory perform a key exchange and encrypt their traffic. Shared memory peers are local processes, so this is off by default. TCP connections are always encrypted. This must be set before the server is started.
+---@param enabled boolean Whether to encrypt shared memory connections.
+function Server:setShmEncryption(enabled)
+  if self._isServing then
+    error("server is already serving")
+  end
+
+  self._shmEncryption = enabled
+end
+
+---Registers a handler for remote procedure calls made with `client:call`. The handler is called with the call's arguments and the calling client's ID, and its return value is sent back to the client. Errors raised by the handler are sent back as the call's error. Pass nil to remove a handler.
+---@param method string The method name.
+---@param handler function? The handler.
+function Server:handle(method, handler)
+  self._handlers[method] = handler
+end
+
+---Starts recording the traffic received from clients to a capture file, which `luadtp.replay` can replay against a server. Frames are recorded after decryption, along with the time they were received, the ID of the client that sent them, and when clients connect and disconnect. Clients that are already connected are recorded as connecting when the capture starts. Captures contain the traffic in plaintext, so they should be handled with care.
+---@param path string The path of the capture file, which is replaced if it exists.
+function Server:startCapture(path)
+  if self._capture ~= nil then
+    error("server is already capturing")
+  end
+
+  self._capture = capture.CaptureWriter.open(path)
+
+  for clientId, _ in pairs(self._clients) do
+    self._capture:record(clientId, capture.recordTypes.connect)
+  end
+end
+
+---Stops recording traffic, and closes the capture file. Stopping the server also stops the capture.
+function Server:stopCapture()
+  if self._capture == nil then
+    error("server is not capturing")
+  end
+
+  self._capture:close()
+  self._capture = nil
+end
+
+---Enables the unreliable datagram channel, through which `sendUnreliable` messages are exchanged. The server listens for datagrams on the same address and port as for connections. This must be set before the server is started, and has no effect on shared memory servers.
+function Server:enableUnreliable()
+  if self._isServing then
+    error("server is already serving")
+  end
+
+  self._udpEnabled = true
+end
+
+---Sets how long a connecting client has to complete the key exchange before it is dropped. Pass nil to wait indefinitely. Key exchanges run alongside the established clients, so a slow client does not hold up the server.
+---@param seconds number? The handshake timeout, in seconds.
+function Server:setHandshakeTimeout(seconds)
+  self._handshakeTimeout = seconds
+end
+
+---Sets how much is read from each client on each turn of the server loop. Clients take turns in round-robin order, and each turn reads frames from a client until it has used up its quantum of bytes or read the maximum number of frames, so that a client flooding the server cannot delay the others. A per-client rate limit can also be set, beyond which clients are not read from at all. Omitted limits take their defaults.
+---@param limits ReadLimits The read limits.
+function Server:setReadLimits(limits)
+  self._readLimits = limits
+
+  for _, client in pairs(self._clients) do
+    client.readTokens = limits.burstBytes or math.ceil(limits.bytesPerSecond or 0)
+    client.readRefilled = socket.gettime()
+  end
+end
+
+---Limits how quickly new connections are admitted, so that a flood of connections cannot starve established clients of the key exchange work it causes. Connections over the pending handshake limit or the accept rate wait in the listen backlog, and connections over the client limits are closed before any key exchange work is done. Omitted limits are unlimited, which is the default.
+---@param limits AdmissionLimits The admission limits.
+function Server:setAdmissionLimits(limits)
+  self._admission = limits
+  self._acceptTokens = limits.acceptBurst or math.ceil(limits.acceptRate or 0)
+  self._acceptRefilled = socket.gettime()
 end
 
 return {
@@ -0,0 +1,245 @@
+local shmcore = require("luadtp.shmcore")
+local socket = require("socket")
+
+-- The address scheme that selects the shared memory transport.
+local scheme = "^shm://(.+)$"
+
+---@class ShmConnection
+---@field _conn userdata The native connection.
+---@field _name string The name of the listener the connection was made through.
+---@field _timeout number? The receive timeout, in seconds, or nil to block.
+---@field _pending string[] Bytes received ahead of a partially satisfied receive.
+---@field _pendingSize integer The total number of pending bytes.
+---@field _closed boolean Whether the connection has been closed locally.
+local ShmConnection = {}
+ShmConnection.__index = ShmConnection
+
+---Shared memory connections write buffers straight from their memory, so they need not be converted to strings before sending.
+ShmConnection.acceptsBuffers = true
+
+---@class ShmListener
+---@field _listener userdata The native listener.
+---@field _name string The listener name.
+local ShmListener = {}
+ShmListener.__index = ShmListener
+
+---Parses a shared memory address.
+---@param host string The host address.
+---@return string? # The listener name, or nil if the address does not use the shared memory scheme.
+local function parseAddress(host)
+  if type(host) ~= "string" then
+    return nil
+  end
+
+  return string.match(host, scheme)
+end
+
+---Wraps a native connection.
+---@param conn userdata The native connection.
+---@param name string The listener name.
+---@return ShmConnection
+local function wrapConnection(conn, name)
+  return setmetatable({
+    _conn = conn,
+    _name = name,
+    _timeout = nil,
+    _pending = {},
+    _pendingSize = 0,
+    _closed = false,
+  }, ShmConnection)
+end
+
+---Listens for shared memory connections.
+---@param name string The name clients connect to.
+---@param encrypted boolean Whether connections perform a key exchange and encrypt their traffic.
+---@return ShmListener? # The listener.
+---@return string? # An error message, if listening failed.
+local function listen(name, encrypted)
+  local listener, err = shmcore.listen(name, encrypted)
+  if listener == nil then
+    return nil, err
+  end
+
+  return setmetatable({
+    _listener = listener,
+    _name = name,
+  }, ShmListener), nil
+end
+
+---Connects to a shared memory listener.
+---@param name string The listener name.
+---@param timeout number? How long to wait for the server to accept the connection, in seconds. Defaults to 5.
+---@return ShmConnection? # The connection.
+---@return string? # An error message, if connecting failed.
+local function connect(name, timeout)
+  local conn, err = shmcore.connect(name, timeout)
+  if conn == nil then
+    return nil, err
+  end
+
+  return wrapConnection(conn, name), nil
+end
+
+---Returns a connection that has been requested by a client, if there is one.
+---@return ShmConnection?
+---@return string? # "timeout" if no connection is waiting.
+function ShmListener:accept()
+  local conn = self._listener:accept()
+  if conn == nil then
+    return nil, "timeout"
+  end
+
+  return wrapConnection(conn, self._name), nil
+end
+
+---Accepting connections never blocks, so this has no effect.
+function ShmListener:settimeout()
+end
+
+---Shared memory listeners have no socket options, so this has no effect.
+function ShmListener:setoption()
+end
+
+---Returns the listener's address.
+---@return string
+---@return integer
+function ShmListener:getsockname()
+  return "shm://" .. self._name, 0
+end
+
+---Closes the listener.
+function ShmListener:close()
+  self._listener:close()
+end
+
+---Sets the receive timeout.
+---@param timeout number? The timeout, in seconds. 0 never blocks, nil blocks indefinitely.
+function ShmConnection:settimeout(timeout)
+  if timeout ~= nil and timeout < 0 then
+    timeout = nil
+  end
+
+  self._timeout = timeout
+end
+
+---Shared memory connections have no socket options, so this has no effect.
+function ShmConnection:setoption()
+end
+
+---Receives an exact number of bytes. Bytes that arrive before a receive times out are kept for the next receive.
+---@param size integer The number of bytes to receive.
+---@return string?
+---@return string? # "timeout" or "closed" on failure.
+function ShmConnection:receive(size)
+  if self._closed then
+    return nil, "closed"
+  end
+
+  local deadline = nil
+  if self._timeout ~= nil and self._timeout > 0 then
+    deadline = socket.gettime() + self._timeout
+  end
+
+  while self._pendingSize < size do
+    local chunk, err = self._conn:read(size - self._pendingSize)
+    if chunk == nil then
+      return nil, err
+    end
+
+    if #chunk > 0 then
+      self._pending[#self._pending + 1] = chunk
+      self._pendingSize = self._pendingSize + #chunk
+    elseif self._timeout == 0 then
+      return nil, "timeout"
+    elseif deadline == nil then
+      self._conn:wait_readable()
+    else
+      local remaining = deadline - socket.gettime()
+      if remaining <= 0 then
+        return nil, "timeout"
+      end
+
+      self._conn:wait_readable(remaining)
+    end
+  end
+
+  local data = table.concat(self._pending)
+  self._pending = {}
+  self._pendingSize = 0
+
+  return data, nil
+end
+
+---Sends bytes, waiting for the peer to make room in the ring as necessary.
+---@param data string|Buffer The bytes to send.
+---@return integer? # The number of bytes sent.
+---@return string? # "closed" on failure.
+function ShmConnection:send(data)
+  if self._closed then
+    return nil, "closed"
+  end
+
+  local sent = 0
+
+  while sent < #data do
+    local n, err = self._conn:write(data, sent)
+    if n == nil then
+      return nil, err
+    end
+
+    sent = sent + n
+
+    if sent < #data then
+      self._conn:wait_writable()
+    end
+  end
+
+  return sent, nil
+end
+
+---Blocks until the connection is readable or a timeout elapses.
+---@param timeout number? The timeout, in seconds, or nil to wait indefinitely.
+---@return boolean # Whether the connection is readable.
+function ShmConnection:waitReadable(timeout)
+  if self._closed then
+    return true
+  end
+
+  return self._conn:wait_readable(timeout)
+end
+
+---Is the connection encrypted?
+---@return boolean
+function ShmConnection:encrypted()
+  return self._conn:encrypted()
+end
+
+---Returns the local address.
+---@return string
+---@return integer
+function ShmConnection:getsockname()
+  return "shm://" .. self._name, 0
+end
+
+---Returns the remote address.
+---@return string
+---@return integer
+function ShmConnection:getpeername()
+  return "shm://" .. self._name, 0
+end
+
+---Closes the connection.
+function ShmConnection:close()
+  if not self._closed then
+    self._closed = true
+    self._conn:close()
+  end
+end
+
+return {
+  parseAddress = parseAddress,
+  listen = listen,
+  connect = connect,
+  ShmConnection = ShmConnection,
+  ShmListener = ShmListener,
+}
@@ -0,0 +1,97 @@
+---@class StateDelta
+---@field set table The fields that were added or changed, with their new values.
+---@field removed any[] The keys of the fields that were removed.
+
+---Copies a value, recursing into tables. Values must not contain cycles.
+---@param value any The value.
+---@return any # The copy.
+local function copy(value)
+  if type(value) ~= "table" then
+    return value
+  end
+
+  local result = {}
+
+  for k, v in pairs(value) do
+    result[k] = copy(v)
+  end
+
+  return result
+end
+
+---Compares two values, recursing into tables.
+---@param a any The first value.
+---@param b any The second value.
+---@return boolean # Whether the values are equal.
+local function equal(a, b)
+  if a == b then
+    return true
+  end
+
+  if type(a) ~= "table" or type(b) ~= "table" then
+    return false
+  end
+
+  for k, v in pairs(a) do
+    if not equal(v, b[k]) then
+      return false
+    end
+  end
+
+  for k, _ in pairs(b) do
+    if a[k] == nil then
+      return false
+    end
+  end
+
+  return true
+end
+
+---Computes the fields of a keyed table that differ from a previous snapshot of it.
+---@param snapshot table The previous snapshot.
+---@param current table The current table.
+---@return StateDelta? # The changes, or nil if nothing changed.
+local function diff(snapshot, current)
+  local set = {}
+  local removed = {}
+  local changed = false
+
+  for k, v in pairs(current) do
+    if not equal(snapshot[k], v) then
+      set[k] = copy(v)
+      changed = true
+    end
+  end
+
+  for k, _ in pairs(snapshot) do
+    if current[k] == nil then
+      removed[#removed + 1] = k
+      changed = true
+    end
+  end
+
+  if not changed then
+    return nil
+  end
+
+  return { set = set, removed = removed }
+end
+
+---Applies changes to a snapshot in place.
+---@param snapshot table The snapshot.
+---@param delta StateDelta The changes.
+local function apply(snapshot, delta)
+  for k, v in pairs(delta.set) do
+    snapshot[k] = v
+  end
+
+  for _, k in ipairs(delta.removed) do
+    snapshot[k] = nil
+  end
+end
+
+return {
+  copy = copy,
+  diff = diff,
+  apply = apply,
+}
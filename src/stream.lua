@@ -0,0 +1,288 @@
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+local socket = require("socket")
+
+-- The size of a stream ID.
+local streamIdSize = 2
+
+-- The largest stream ID.
+local maxStreamId = 65535
+
+-- The largest number of payload bytes carried by a single chunk frame.
+local chunkSize = 16384
+
+-- The largest number of payload bytes written by a single flush, so that a busy connection cannot stall the loop polling it.
+local bytesPerFlush = 262144
+
+---@class StreamQueue
+---@field messages string[] The serialized messages waiting to be sent, oldest first.
+---@field head integer The index of the message currently being sent.
+---@field tail integer The index of the most recently queued message.
+---@field offset integer The number of bytes of the current message that have been sent.
+---@field deficit number The number of bytes the stream may send before yielding its turn.
+---@field credited boolean Whether the stream has received its quantum for the current turn.
+
+---@class Outbox
+---@field _conn ClientInner The connection frames are written to.
+---@field _key string? The AES key, or nil if the connection is not encrypted.
+---@field _weights { [integer]: number } The scheduling weights of streams, keyed by stream ID.
+---@field _streams { [integer]: StreamQueue } The streams with queued messages, keyed by stream ID.
+---@field _active integer[] The IDs of streams with queued messages, in round-robin order.
+---@field _cursor integer The index in the active list of the stream whose turn it is.
+---@field _partial string? A frame that has only been partially written.
+---@field _partialOffset integer The index of the first unwritten byte of the partial frame.
+---@field _queuedBytes integer The number of queued stream bytes that have not been written yet.
+local Outbox = {}
+Outbox.__index = Outbox
+
+---@class Inbox
+---@field _chunks { [integer]: string[] } The chunks received so far of each stream's current message, keyed by stream ID.
+local Inbox = {}
+Inbox.__index = Inbox
+
+---Validates a stream ID.
+---@param stream integer The stream ID.
+local function checkStreamId(stream)
+  if type(stream) ~= "number" or stream < 0 or stream > maxStreamId or stream % 1 ~= 0 then
+    error("invalid stream ID: " .. tostring(stream))
+  end
+end
+
+---Encodes the header of a chunk frame.
+---@param stream integer The stream ID.
+---@param final boolean Whether the chunk is the last of its message.
+---@return string # The encoded header.
+local function encodeHeader(stream, final)
+  return util.encodeInteger(stream, streamIdSize) .. string.char(final and 1 or 0)
+end
+
+---Decodes the header of a chunk frame.
+---@param header string The encoded header.
+---@return integer # The stream ID.
+---@return boolean # Whether the chunk is the last of its message.
+local function decodeHeader(header)
+  return util.decodeInteger(header, 1, streamIdSize), string.byte(header, streamIdSize + 1) == 1
+end
+
+---Constructs and returns a new outbox.
+---@param conn ClientInner The connection frames are written to.
+---@param key string? The AES key, or nil if the connection is not encrypted.
+---@param weights { [integer]: number } The scheduling weights of streams, keyed by stream ID. Streams without a weight have a weight of 1. The table is shared, not copied.
+---@return Outbox
+function Outbox.new(conn, key, weights)
+  local outbox = setmetatable({
+    _conn = conn,
+    _key = key,
+    _weights = weights,
+    _streams = {},
+    _active = {},
+    _cursor = 1,
+    _partial = nil,
+    _partialOffset = 1,
+    _queuedBytes = 0,
+  }, Outbox)
+
+  return outbox
+end
+
+---Continues writing the partially written frame, if there is one.
+---@param outbox Outbox The outbox.
+---@param blocking boolean Whether to wait for the connection to accept the rest of the frame.
+---@return boolean # Whether the frame has been written completely.
+---@return string? # An error message, if the connection failed.
+local function finishPartial(outbox, blocking)
+  while outbox._partial ~= nil do
+    local last, err, partial = outbox._conn:send(outbox._partial, outbox._partialOffset)
+
+    if last ~= nil then
+      outbox._partial = nil
+      outbox._partialOffset = 1
+    elseif err ~= "timeout" then
+      return false, err
+    else
+      outbox._partialOffset = partial + 1
+
+      if not blocking then
+        return false, nil
+      end
+
+      socket.select(nil, { outbox._conn }, nil)
+    end
+  end
+
+  return true, nil
+end
+
+---Writes a chunk frame without blocking, keeping whatever the connection does not accept for later.
+---@param outbox Outbox The outbox.
+---@param buffer string The encoded frame.
+---@return boolean # Whether the frame has been written completely.
+---@return string? # An error message, if the connection failed.
+local function writeChunk(outbox, buffer)
+  outbox._partial = buffer
+  outbox._partialOffset = 1
+  return finishPartial(outbox, false)
+end
+
+---Queues a serialized message to be sent on a stream.
+---@param stream integer The stream ID.
+---@param payload string The serialized message.
+function Outbox:push(stream, payload)
+  checkStreamId(stream)
+
+  local queue = self._streams[stream]
+  if queue == nil then
+    queue = {
+      messages = {},
+      head = 1,
+      tail = 0,
+      offset = 0,
+      deficit = 0,
+      credited = false,
+    }
+    self._streams[stream] = queue
+    self._active[#self._active + 1] = stream
+  end
+
+  queue.tail = queue.tail + 1
+  queue.messages[queue.tail] = payload
+  self._queuedBytes = self._queuedBytes + #payload
+end
+
+---Writes a frame outside of any stream, ahead of all queued stream data. The frame is only written once any partially written chunk has been completed, so frames are never interleaved.
+---@param buffer string|Buffer The encoded frame.
+---@return integer? # The number of bytes written.
+---@return string? # An error message, if the connection failed.
+function Outbox:send(buffer)
+  local _, err = finishPartial(self, true)
+  if err ~= nil then
+    return nil, err
+  end
+
+  if type(buffer) ~= "string" and not self._conn.acceptsBuffers then
+    buffer = buffer:sub()
+  end
+
+  return self._conn:send(buffer)
+end
+
+---Writes queued stream data without blocking. Streams take turns in deficit round-robin order: on each turn a stream may send a number of bytes proportional to its weight, so a high-weight stream's messages are not held up behind a large message on a low-weight stream.
+---@return string? # An error message, if the connection failed.
+function Outbox:flush()
+  local done, err = finishPartial(self, false)
+  if not done then
+    return err
+  end
+
+  local budget = bytesPerFlush
+
+  while budget > 0 and #self._active > 0 do
+    if self._cursor > #self._active then
+      self._cursor = 1
+    end
+
+    local stream = self._active[self._cursor]
+    local queue = self._streams[stream]
+
+    if not queue.credited then
+      queue.deficit = queue.deficit + chunkSize * (self._weights[stream] or 1)
+      queue.credited = true
+    end
+
+    while queue.deficit > 0 and budget > 0 and queue.head <= queue.tail do
+      local message = queue.messages[queue.head]
+      local chunk = string.sub(message, queue.offset + 1, queue.offset + chunkSize)
+      queue.offset = queue.offset + #chunk
+      local final = queue.offset >= #message
+
+      if final then
+        queue.messages[queue.head] = nil
+        queue.head = queue.head + 1
+        queue.offset = 0
+      end
+
+      queue.deficit = queue.deficit - #chunk
+      budget = budget - #chunk
+      self._queuedBytes = self._queuedBytes - #chunk
+
+      local written, err = writeChunk(self, frame.encode(self._key, frame.kinds.chunk, chunk, encodeHeader(stream, final)))
+      if not written then
+        return err
+      end
+    end
+
+    if queue.head > queue.tail then
+      self._streams[stream] = nil
+      table.remove(self._active, self._cursor)
+    elseif queue.deficit <= 0 then
+      queue.credited = false
+      self._cursor = self._cursor + 1
+    end
+  end
+
+  return nil
+end
+
+---Is any stream data waiting to be written?
+---@return boolean
+function Outbox:pending()
+  return self._partial ~= nil or #self._active > 0
+end
+
+---Returns the number of bytes waiting to be written, including the unwritten part of a partially written frame.
+---@return integer
+function Outbox:pendingBytes()
+  local partial = 0
+  if self._partial ~= nil then
+    partial = #self._partial - self._partialOffset + 1
+  end
+
+  return self._queuedBytes + partial
+end
+
+---Constructs and returns a new inbox.
+---@return Inbox
+function Inbox.new()
+  local inbox = setmetatable({
+    _chunks = {},
+  }, Inbox)
+
+  return inbox
+end
+
+---Adds a received chunk to its stream's current message.
+---@param header string The chunk frame's header.
+---@param payload string The chunk.
+---@return integer # The stream ID.
+---@return string? # The complete serialized message, if this was its last chunk.
+function Inbox:add(header, payload)
+  local stream, final = decodeHeader(header)
+  local chunks = self._chunks[stream]
+
+  if final and chunks == nil then
+    return stream, payload
+  end
+
+  if chunks == nil then
+    chunks = {}
+    self._chunks[stream] = chunks
+  end
+
+  chunks[#chunks + 1] = payload
+
+  if not final then
+    return stream, nil
+  end
+
+  self._chunks[stream] = nil
+  return stream, table.concat(chunks)
+end
+
+return {
+  Outbox = Outbox,
+  Inbox = Inbox,
+  checkStreamId = checkStreamId,
+  maxStreamId = maxStreamId,
+}
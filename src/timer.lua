@@ -0,0 +1,281 @@
+local socket = require("socket")
+
+-- The number of slots in each level of the wheel.
+local slotCount = 256
+
+-- The number of levels in the wheel. With the default resolution this covers roughly 497 days.
+local levelCount = 4
+
+---@class Timer
+---@field _callback function The function to call when the timer fires.
+---@field _interval integer? The repeat interval in ticks, for periodic timers.
+---@field _expires integer The tick at which the timer fires.
+---@field _cancelled boolean Whether the timer has been cancelled.
+---@field _wheel TimerWheel The wheel the timer belongs to.
+---@field _prev table? The previous entry in the timer's slot list.
+---@field _next table? The next entry in the timer's slot list.
+local Timer = {}
+Timer.__index = Timer
+
+---@class TimerWheel
+---@field _resolution number The duration of a single tick, in seconds.
+---@field _start number The time at which tick 0 began.
+---@field _tick integer The next tick to be processed.
+---@field _count integer The number of timers currently scheduled.
+---@field _levels table[] The slot lists for each level of the wheel.
+local TimerWheel = {}
+TimerWheel.__index = TimerWheel
+
+---Removes a timer from the slot list it is currently in.
+---@param timer Timer The timer.
+local function unlink(timer)
+  timer._prev._next = timer._next
+  timer._next._prev = timer._prev
+  timer._prev = nil
+  timer._next = nil
+end
+
+---Places a timer in the slot matching its expiration tick.
+---@param wheel TimerWheel The timer wheel.
+---@param timer Timer The timer.
+local function place(wheel, timer)
+  local expires = timer._expires
+  local delta = expires - wheel._tick
+  local level
+  local index
+
+  if delta < 0 then
+    level = 1
+    index = wheel._tick % slotCount
+  elseif delta < slotCount then
+    level = 1
+    index = expires % slotCount
+  else
+    local span = slotCount
+    level = 2
+
+    while level < levelCount and delta >= span * slotCount do
+      span = span * slotCount
+      level = level + 1
+    end
+
+    if delta >= span * slotCount then
+      expires = wheel._tick + span * slotCount - 1
+    end
+
+    index = math.floor(expires / span) % slotCount
+  end
+
+  local slots = wheel._levels[level]
+  local head = slots[index + 1]
+
+  if head == nil then
+    head = {}
+    head._prev = head
+    head._next = head
+    slots[index + 1] = head
+  end
+
+  timer._prev = head._prev
+  timer._next = head
+  head._prev._next = timer
+  head._prev = timer
+end
+
+---Moves every timer in a higher level slot down to the levels below it.
+---@param wheel TimerWheel The timer wheel.
+---@param level integer The level to cascade from.
+---@param index integer The slot index within the level.
+local function cascade(wheel, level, index)
+  local head = wheel._levels[level][index + 1]
+  if head == nil then
+    return
+  end
+
+  local timer = head._next
+  head._prev = head
+  head._next = head
+
+  while timer ~= head do
+    local nextTimer = timer._next
+    place(wheel, timer)
+    timer = nextTimer
+  end
+end
+
+---Processes a single tick, collecting the timers that expire on it.
+---@param wheel TimerWheel The timer wheel.
+---@param fired Timer[] The list to collect expired timers in.
+local function step(wheel, fired)
+  local tick = wheel._tick
+  local index = tick % slotCount
+
+  if index == 0 then
+    local span = 1
+
+    for level = 2, levelCount do
+      span = span * slotCount
+      local levelIndex = math.floor(tick / span) % slotCount
+      cascade(wheel, level, levelIndex)
+
+      if levelIndex ~= 0 then
+        break
+      end
+    end
+  end
+
+  local head = wheel._levels[1][index + 1]
+  if head ~= nil then
+    local timer = head._next
+    head._prev = head
+    head._next = head
+
+    while timer ~= head do
+      local nextTimer = timer._next
+      timer._prev = nil
+      timer._next = nil
+      wheel._count = wheel._count - 1
+      fired[#fired + 1] = timer
+      timer = nextTimer
+    end
+  end
+
+  wheel._tick = tick + 1
+end
+
+---Returns the tick at which a given delay starting now will have elapsed.
+---@param wheel TimerWheel The timer wheel.
+---@param seconds number The delay, in seconds.
+---@return integer # The expiration tick.
+local function expirationTick(wheel, seconds)
+  local expires = math.ceil((socket.gettime() + seconds - wheel._start) / wheel._resolution)
+  if expires < wheel._tick then
+    expires = wheel._tick
+  end
+
+  return expires
+end
+
+---Cancels the timer. Cancelling a timer that has already fired or been cancelled has no effect.
+function Timer:cancel()
+  self._cancelled = true
+
+  if self._next ~= nil then
+    unlink(self)
+    self._wheel._count = self._wheel._count - 1
+  end
+end
+
+---Is the timer still waiting to fire?
+---@return boolean
+function Timer:pending()
+  return self._next ~= nil
+end
+
+---Constructs and returns a new timer wheel.
+---@param resolution number? The duration of a single tick, in seconds. Defaults to 10 milliseconds.
+---@return TimerWheel
+function TimerWheel.new(resolution)
+  local levels = {}
+
+  for level = 1, levelCount do
+    levels[level] = {}
+  end
+
+  local wheel = setmetatable({
+    _resolution = resolution or 0.01,
+    _start = socket.gettime(),
+    _tick = 0,
+    _count = 0,
+    _levels = levels,
+  }, TimerWheel)
+
+  return wheel
+end
+
+---Schedules a function to be called after a delay.
+---@param seconds number The delay, in seconds.
+---@param callback function The function to call.
+---@param interval number? If given, the timer repeats with this interval, in seconds, until cancelled.
+---@return Timer # The scheduled timer.
+function TimerWheel:schedule(seconds, callback, interval)
+  local timer = setmetatable({
+    _callback = callback,
+    _interval = nil,
+    _expires = expirationTick(self, seconds),
+    _cancelled = false,
+    _wheel = self,
+    _prev = nil,
+    _next = nil,
+  }, Timer)
+
+  if interval ~= nil then
+    timer._interval = math.max(math.ceil(interval / self._resolution), 1)
+  end
+
+  place(self, timer)
+  self._count = self._count + 1
+
+  return timer
+end
+
+---Fires every timer that has expired by the current time.
+function TimerWheel:advance()
+  local target = math.floor((socket.gettime() - self._start) / self._resolution)
+  local fired = {}
+
+  while self._tick <= target and self._count > 0 do
+    step(self, fired)
+  end
+
+  if self._tick <= target then
+    self._tick = target + 1
+  end
+
+  for i = 1, #fired do
+    local timer = fired[i]
+
+    if not timer._cancelled then
+      if timer._interval ~= nil then
+        timer._expires = math.max(timer._expires + timer._interval, self._tick)
+        place(self, timer)
+        self._count = self._count + 1
+      end
+
+      timer._callback()
+    end
+  end
+end
+
+---Returns how long until `advance` may next have timers to fire. Timers in the higher levels are only looked at once they cascade down, so the delay may be shorter than the time until the next timer actually expires, but never longer.
+---@return number? # The delay in seconds, or nil if no timers are scheduled.
+function TimerWheel:nextDelay()
+  if self._count == 0 then
+    return nil
+  end
+
+  local slots = self._levels[1]
+  local tick = self._tick
+
+  repeat
+    local head = slots[tick % slotCount + 1]
+    if head ~= nil and head._next ~= head then
+      break
+    end
+
+    tick = tick + 1
+  until tick % slotCount == 0
+
+  return math.max(tick * self._resolution + self._start - socket.gettime(), 0)
+end
+
+---Returns the number of timers currently scheduled.
+---@return integer
+function TimerWheel:count()
+  return self._count
+end
+
+return {
+  Timer = Timer,
+  TimerWheel = TimerWheel,
+}
@@ -1,20 +1,56 @@
 local crypto = require("luadtp.cryptocore")
+---@module "src.cryptoffi"
+local cryptoffi = require("luadtp.cryptoffi")
 local binser = require("binser")
 
+-- The message size functions, bound through the FFI when running under LuaJIT.
+local encode_message_size = cryptoffi.encode_message_size or crypto.encode_message_size
+local decode_message_size = cryptoffi.decode_message_size or crypto.decode_message_size
+
 local lenSize = 5
 
 ---Encodes the size portion of a message.
 ---@param size integer The size of the message.
 ---@return string # The encoded size.
 local function encodeMessageSize(size)
-  return crypto.encode_message_size(size)
+  return encode_message_size(size)
 end
 
 ---Decodes the size portion of a message.
 ---@param encodedSize string The encoded message size.
 ---@return integer # The decoded size.
 local function decodeMessageSize(encodedSize)
-  return crypto.decode_message_size(encodedSize)
+  return decode_message_size(encodedSize)
+end
+
+---Encodes an unsigned integer as a fixed number of big-endian bytes.
+---@param value integer The integer.
+---@param size integer The number of bytes.
+---@return string # The encoded integer.
+local function encodeInteger(value, size)
+  local bytes = {}
+
+  for i = size, 1, -1 do
+    bytes[i] = string.char(value % 256)
+    value = math.floor(value / 256)
+  end
+
+  return table.concat(bytes)
+end
+
+---Decodes an unsigned integer from a fixed number of big-endian bytes.
+---@param encoded string The bytes to decode from.
+---@param offset integer The position of the first byte.
+---@param size integer The number of bytes.
+---@return integer # The decoded integer.
+local function decodeInteger(encoded, offset, size)
+  local value = 0
+
+  for i = offset, offset + size - 1 do
+    value = value * 256 + string.byte(encoded, i)
+  end
+
+  return value
 end
 
 ---Serializes a piece of data.
@@ -36,6 +72,8 @@ return {
   lenSize = lenSize,
   encodeMessageSize = encodeMessageSize,
   decodeMessageSize = decodeMessageSize,
+  encodeInteger = encodeInteger,
+  decodeInteger = decodeInteger,
   serialize = serialize,
   deserialize = deserialize
 }
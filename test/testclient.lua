@@ -3,7 +3,20 @@ local luadtp = require("luadtp")
 local crypto = require("luadtp.crypto")
 ---@module "src.util"
 local util = require("luadtp.util")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+---@module "src.capture"
+local capture = require("luadtp.capture")
+---@module "src.replay"
+local replay = require("luadtp.replay")
+---@module "src.stream"
+local stream = require("luadtp.stream")
+---@module "src.batch"
+local batch = require("luadtp.batch")
+---@module "src.message"
+local messageImpl = require("luadtp.message")
 local testutils = require("test.testutils")
+local socket = require("socket")
 
 ---Tests serialization and deserialization functions.
 local function testSerializeDeserialize()
@@ -75,6 +88,206 @@ local function testCrypto()
   testutils.assertNe(key2, encryptedKey)
 end
 
+---Tests that the LuaJIT FFI bindings, when they are in use, agree with the Lua C API bindings.
+local function testCryptoFfi()
+  local cryptocore = require("luadtp.cryptocore")
+  local cryptoffi = require("luadtp.cryptoffi")
+  if cryptoffi.aes_encrypt == nil then
+    print("FFI bindings are not in use")
+    return
+  end
+
+  local key = crypto.newAesKey()
+  for size = 0, 64 do
+    local message = string.rep("x", size)
+    testutils.assertEq(cryptocore.aes_decrypt(key, cryptoffi.aes_encrypt(key, message)), message)
+    testutils.assertEq(cryptoffi.aes_decrypt(key, cryptocore.aes_encrypt(key, message)), message)
+  end
+
+  testutils.assertEq(cryptoffi.encode_message_size(47362409218), cryptocore.encode_message_size(47362409218))
+  testutils.assertEq(cryptoffi.decode_message_size(string.char(11, 7, 5, 3, 2)), 47362409218)
+end
+
+---Tests byte buffers.
+local function testBuffer()
+  local buffer = crypto.newBuffer("Hello")
+  testutils.assertEq(crypto.isBuffer(buffer), true)
+  testutils.assertEq(crypto.isBuffer("Hello"), false)
+  buffer:append(", world!")
+  testutils.assertEq(buffer:len(), 13)
+  testutils.assertEq(#buffer, 13)
+  testutils.assertEq(buffer:sub(), "Hello, world!")
+  testutils.assertEq(buffer:sub(8, -2), "world")
+  testutils.assertEq(buffer:byte(1), string.byte("H"))
+  testutils.assertEq(buffer:byte(14), nil)
+
+  buffer:write(1, "J")
+  testutils.assertEq(buffer:slice(1, 5):sub(), "Jello")
+  buffer:resize(3)
+  buffer:append(buffer)
+  testutils.assertEq(tostring(buffer), "JelJel")
+  buffer:append("abcdef", 4)
+  testutils.assertEq(buffer:sub(), "JelJeldef")
+
+  local capacity = buffer:capacity()
+  buffer:clear()
+  testutils.assertEq(buffer:len(), 0)
+  testutils.assertEq(buffer:capacity(), capacity)
+
+  local key = crypto.newAesKey()
+  local message = crypto.newBuffer(string.rep("\0\1\2\255", 100))
+  local encrypted = crypto.newBuffer("header")
+  crypto.aesEncryptInto(key, message, encrypted)
+  testutils.assertEq(crypto.aesDecrypt(key, encrypted:sub(7)), message:sub())
+  local decrypted = crypto.newBuffer()
+  crypto.aesDecryptInto(key, encrypted, 7, decrypted)
+  testutils.assertEq(decrypted:sub(), message:sub())
+end
+
+---Tests that an outbox delivers every queued stream message in order, including messages queued on a stream while it is only partially drained.
+local function testOutboxQueue()
+  local written = {}
+  local conn = {
+    send = function (_, data, i)
+      written[#written + 1] = string.sub(data, i or 1)
+      return #data
+    end,
+  }
+
+  local outbox = stream.Outbox.new(conn, nil, {})
+  local large = string.rep("a", 300000)
+  outbox:push(1, large)
+  outbox:push(2, "first")
+
+  -- The large message does not fit in a single flush
+  outbox:flush()
+  assert(outbox:pending())
+  outbox:push(1, "second")
+  outbox:push(2, "third")
+  outbox:push(1, "fourth")
+
+  while outbox:pending() do
+    outbox:flush()
+  end
+
+  local inbox = stream.Inbox.new()
+  local received = { {}, {} }
+
+  for _, buffer in ipairs(written) do
+    local kind, payload, header = frame.decode(nil, string.sub(buffer, util.lenSize + 1))
+    testutils.assertEq(kind, frame.kinds.chunk)
+
+    local streamId, message = inbox:add(header, payload)
+    if message ~= nil then
+      received[streamId][#received[streamId] + 1] = message
+    end
+  end
+
+  testutils.assertEq(received, { { large, "second", "fourth" }, { "first", "third" } })
+end
+
+---Tests that batch payloads are split back into their messages, and that truncated payloads are rejected.
+local function testBatchMessages()
+  local payload = util.encodeMessageSize(5) .. "first" .. util.encodeMessageSize(0) .. util.encodeMessageSize(6) .. "second"
+  local received = {}
+
+  for message in batch.messages(payload) do
+    received[#received + 1] = message
+  end
+
+  testutils.assertEq(received, { "first", "", "second" })
+
+  local truncatedMessage = string.sub(payload, 1, #payload - 1)
+  local truncatedSize = util.encodeMessageSize(5) .. "first" .. string.sub(util.encodeMessageSize(6), 1, 2)
+
+  for _, malformed in ipairs({ truncatedMessage, truncatedSize }) do
+    local ok = pcall(function ()
+      for _ in batch.messages(malformed) do
+      end
+    end)
+    assert(not ok)
+  end
+end
+
+---Tests that routed messages are rejected when opened if their header or payload has been tampered with.
+local function testRoutedTampering()
+  local key = messageImpl.deriveKey(crypto.newAesKey())
+  local header = messageImpl.encodeHeader(1, 7)
+  local encoded = frame.encode(key, frame.kinds.routed, util.serialize(testutils.sendMessageFromClient), header)
+  local body = string.sub(encoded, util.lenSize + 1)
+
+  local kind, payload, received = frame.decode(key, body)
+  testutils.assertEq(kind, frame.kinds.routed)
+  testutils.assertEq(messageImpl.Message.new(key, received, payload):data(), testutils.sendMessageFromClient)
+
+  local function change(s, i)
+    return string.sub(s, 1, i - 1) .. string.char((string.byte(s, i) + 1) % 256) .. string.sub(s, i + 1)
+  end
+
+  -- The last byte of the routing key, and the first byte of the nonce that follows the header
+  for _, tampered in ipairs({ change(body, 7), change(change(body, 7), 8), change(body, #body) }) do
+    local _, tamperedPayload, tamperedHeader = frame.decode(key, tampered)
+    local routed = messageImpl.Message.new(key, tamperedHeader, tamperedPayload)
+    assert(not pcall(routed.data, routed))
+  end
+end
+
+---Tests that an instance that always needs polling does not keep a reactor from polling instances whose sockets are ready.
+local function testReactorStarvation()
+  local udp = socket.udp()
+  udp:setsockname(testutils.host, 0)
+  local _, port = udp:getsockname()
+  udp:setpeername(testutils.host, port)
+  udp:settimeout(0)
+
+  local busy = {
+    _watch = function ()
+      return 0
+    end,
+  }
+  local busyCo = coroutine.create(function ()
+    while true do
+      coroutine.yield()
+    end
+  end)
+
+  local ready = {
+    _watch = function (_, recvt)
+      recvt[#recvt + 1] = udp
+      return nil
+    end,
+  }
+  local readyCo = coroutine.create(function ()
+    while true do
+      local data = udp:receive()
+      if data ~= nil then
+        coroutine.yield({ eventType = "receive", data = data })
+      end
+
+      coroutine.yield()
+    end
+  end)
+
+  local r = luadtp.reactor()
+  r:add(busy, busyCo)
+  r:add(ready, readyCo)
+  udp:send(testutils.sendMessageFromClient)
+
+  local received = nil
+  for _ = 1, 100 do
+    for _, event in ipairs(r:poll(0.1)) do
+      received = event
+    end
+
+    if received ~= nil then
+      break
+    end
+  end
+
+  testutils.assertEq(received, { eventType = "receive", data = testutils.sendMessageFromClient, source = ready })
+  udp:close()
+end
+
 ---Tests that the client is able to connect to the server.
 local function testClientConnect()
   crypto.sleep(0.1)
@@ -297,6 +510,417 @@ local function testExample()
   client:disconnect()
 end
 
+---Tests that pinged clients stay connected and silent clients are disconnected.
+local function testKeepalive()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portKeepalive)
+  print("Client address: ", client:getAddr())
+
+  -- Answer pings for a while
+  for _ = 1, 100 do
+    testutils.pollNil(co)
+    crypto.sleep(0.01)
+  end
+  assert(client:connected())
+
+  -- Stop answering pings
+  crypto.sleep(0.5)
+  testutils.pollUntilNotNilValue(co, { eventType = "disconnected" })
+  assert(not client:connected())
+  testutils.pollEnd(co)
+end
+
+---Tests communicating with a server through shared memory.
+local function testShm()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.shmAddress)
+  print("Client address: ", client:getAddr())
+
+  crypto.sleep(0.1)
+  client:send(testutils.sendMessageFromClient)
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = testutils.sendMessageFromServer })
+
+  crypto.sleep(0.1)
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending data over the unreliable datagram channel.
+local function testUnreliable()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portUnreliable)
+  print("Client address: ", client:getAddr())
+
+  -- The channel opens once the server's token has been received
+  while not client:sendUnreliable(testutils.sendMessageFromClient) do
+    testutils.pollNil(co)
+  end
+  testutils.pollUntilNotNilValue(co, { eventType = "receiveUnreliable", data = testutils.sendMessageFromServer })
+
+  crypto.sleep(0.1)
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests making remote procedure calls.
+local function testRpc()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portRpc)
+  print("Client address: ", client:getAddr())
+
+  -- Calls are pipelined, so all of them are in flight before any response arrives
+  local calls = {}
+  for i = 1, 10 do
+    calls[i] = client:call("add", { i, i * 2 }, 5)
+  end
+  local failing = client:call("fail", nil, 5)
+  local missing = client:call("missing", nil, 5)
+
+  while not missing:done() do
+    testutils.pollNil(co)
+  end
+
+  for i = 1, 10 do
+    testutils.assertEq({ calls[i]:result() }, { true, i * 3 })
+  end
+  testutils.assertEq({ failing:result() }, { false, "failed on purpose" })
+  testutils.assertEq({ missing:result() }, { false, "unknown method: missing" })
+
+  -- Awaiting a call yields the waiting coroutine until the client has received the response
+  local sum = nil
+  local waiter = coroutine.wrap(function ()
+    sum = client:call("add", { 20, 22 }, 5):await()
+  end)
+  waiter()
+  while sum == nil do
+    testutils.pollNil(co)
+    waiter()
+  end
+  testutils.assertEq(sum, 42)
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests that small stream messages are not held up behind large ones.
+local function testStreams()
+  crypto.sleep(0.1)
+
+  local bulk = string.rep("bulk data ", 100000)
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portStreams)
+  print("Client address: ", client:getAddr())
+
+  client:setStreamWeight(2, 8)
+  client:sendStream(1, bulk)
+  client:sendStream(2, "urgent")
+
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = bulk, stream = 1 })
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = "after bulk", stream = 1 })
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending raw bytes without serialization.
+local function testRaw()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portRaw)
+  print("Client address: ", client:getAddr())
+
+  client:sendRaw(crypto.newBuffer(testutils.rawMessageFromClient))
+
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRaw")
+  testutils.assertEq(crypto.isBuffer(event.data), true)
+  testutils.assertEq(event.data:sub(), testutils.rawMessageFromServer)
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending traffic to a capturing server.
+local function testCapture()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portCapture)
+  print("Client address: ", client:getAddr())
+
+  client:send(testutils.sendMessageFromClient)
+
+  crypto.sleep(0.1)
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests replaying captured traffic against a server.
+local function testReplay()
+  crypto.sleep(0.1)
+
+  local path = os.tmpname()
+  local writer = capture.CaptureWriter.open(path)
+  for clientId = 1, testutils.replayClients do
+    writer:record(clientId, capture.recordTypes.connect)
+    writer:record(clientId, frame.kinds.data, util.serialize(testutils.sendMessageFromClient))
+    writer:record(clientId, frame.kinds.request, util.encodeInteger(1, 4) .. util.serialize({ "add", { clientId, 1 } }))
+    writer:record(clientId, capture.recordTypes.disconnect)
+  end
+  writer:close()
+
+  local report = replay.run(path, testutils.host, testutils.portReplay, { speed = 0 })
+  os.remove(path)
+
+  testutils.assertEq(report.clients, testutils.replayClients)
+  testutils.assertEq(report.messages, testutils.replayClients * 2)
+  testutils.assertEq(report.latency.count, testutils.replayClients)
+  testutils.assertEq(report.latency.failed, 0)
+  assert(report.latency.p50 <= report.latency.p99 and report.latency.p99 <= report.latency.max)
+end
+
+---Tests receiving state published by a server.
+local function testState()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portState)
+  print("Client address: ", client:getAddr())
+
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event, { eventType = "state", name = "game", data = testutils.initialStateFromServer })
+
+  event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event, { eventType = "state", name = "game", data = testutils.changedStateFromServer })
+  testutils.assertEq(client:getState("game"), testutils.changedStateFromServer)
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests connecting to a server that has reached its client limit.
+local function testAdmission()
+  crypto.sleep(0.1)
+
+  local client1 = luadtp.client()
+  local co1 = client1:connect(testutils.host, testutils.portAdmission)
+  print("Client address: ", client1:getAddr())
+
+  local client2 = luadtp.client()
+  local ok, _ = pcall(client2.connect, client2, testutils.host, testutils.portAdmission)
+  testutils.assertEq(ok, false)
+
+  client1:disconnect()
+  testutils.pollEnd(co1)
+end
+
+---Tests subscribing to a topic.
+local function testTopics()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portTopics)
+  print("Client address: ", client:getAddr())
+
+  client:subscribe("news")
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event, { eventType = "receive", data = testutils.publishMessageFromServer, topic = "news" })
+
+  client:unsubscribe("news")
+  event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event, { eventType = "receive", data = testutils.sendMessageFromServer })
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending and receiving messages with a routing header.
+local function testRouted()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portRouted)
+  print("Client address: ", client:getAddr())
+
+  client:subscribe("room")
+  client:sendRouted(1, 7, testutils.sendMessageFromClient)
+  client:sendRouted(2, 9, testutils.sendMessageFromClient)
+
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRouted")
+  testutils.assertEq({ event.message.type, event.message.routingKey }, { 2, 9 })
+  testutils.assertEq(event.message:data(), testutils.sendMessageFromClient)
+
+  event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRouted")
+  testutils.assertEq({ event.message.type, event.message.routingKey }, { 2, 9 })
+  testutils.assertEq(event.message:data(), testutils.sendMessageFromClient)
+
+  event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRouted")
+  testutils.assertEq({ event.message.type, event.message.routingKey }, { 3, 42 })
+  testutils.assertEq(event.message:data(), testutils.sendMessageFromServer)
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending a burst of messages to a server with tight read limits.
+local function testReadLimits()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portReadLimits)
+  print("Client address: ", client:getAddr())
+
+  for i = 1, testutils.readLimitsMessages do
+    client:send({ i, string.rep("x", testutils.readLimitsMessageSize) })
+  end
+
+  crypto.sleep(1)
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending and receiving batched messages.
+local function testBatch()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portBatch)
+  print("Client address: ", client:getAddr())
+
+  client:batch(function ()
+    for i = 1, testutils.batchMessages do
+      client:send(i)
+    end
+  end)
+
+  for i = 1, testutils.batchMessages do
+    testutils.pollUntilNotNilValue(co, { eventType = "receive", data = -i })
+  end
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests driving several clients from a reactor.
+local function testReactor()
+  crypto.sleep(0.1)
+
+  local reactor = luadtp.reactor()
+  local client1 = luadtp.client()
+  reactor:add(client1, client1:connect(testutils.host, testutils.portReactor))
+  print("Client address: ", client1:getAddr())
+  local client2 = luadtp.client()
+  reactor:add(client2, client2:connect(testutils.host, testutils.portReactor))
+  print("Client address: ", client2:getAddr())
+  testutils.assertEq(reactor:count(), 2)
+
+  client1:send(testutils.multipleClientsMessageFromClient1)
+  client2:send(testutils.multipleClientsMessageFromClient2)
+
+  local received = {}
+
+  while received[client1] == nil or received[client2] == nil do
+    for _, event in ipairs(reactor:poll(1)) do
+      testutils.assertEq(event.eventType, "receive")
+      received[event.source] = event.data
+    end
+  end
+
+  testutils.assertEq(received[client1], testutils.multipleClientsMessageFromClient1)
+  testutils.assertEq(received[client2], testutils.multipleClientsMessageFromClient2)
+
+  client1:disconnect()
+  client2:disconnect()
+
+  while reactor:count() > 0 do
+    reactor:poll(1)
+  end
+end
+
+---Tests sending through a connection pool that replaces a failed connection.
+local function testPool()
+  crypto.sleep(0.1)
+
+  local pool = luadtp.pool({ { host = testutils.host, port = testutils.portPool } }, { size = 2 })
+  local co = pool:connect()
+  assert(pool:connected())
+  testutils.assertEq(pool:openCount(), 2)
+
+  pool:send(testutils.multipleClientsMessageFromClient1)
+  pool:send(testutils.multipleClientsMessageFromClient2)
+
+  testutils.pollUntilNotNilValue(co, { eventType = "disconnected", connection = 1 })
+  testutils.pollUntilNotNilValue(co, { eventType = "reconnected", connection = 1 })
+  testutils.assertEq(pool:openCount(), 2)
+
+  pool:send(testutils.sendMessageFromClient)
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = testutils.sendMessageFromServer, connection = 1 })
+
+  pool:disconnect()
+  assert(not pool:connected())
+  testutils.pollEnd(co)
+end
+
+---Tests sending a frame whose size prefix and body are written in separate pieces.
+local function testSplitFrame()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portSplitFrame)
+  print("Client address: ", client:getAddr())
+
+  -- The pieces split both the size prefix and the body, with pauses so that they arrive separately
+  local encoded = frame.encode(client._key, frame.kinds.data, util.serialize(testutils.sendMessageFromClient))
+  client._sock:send(string.sub(encoded, 1, 3))
+  crypto.sleep(0.1)
+  client._sock:send(string.sub(encoded, 4, util.lenSize + 8))
+  crypto.sleep(0.1)
+  client._sock:send(string.sub(encoded, util.lenSize + 9))
+
+  client:send(testutils.sendingCustomTypesMessageFromClient)
+
+  -- The server splits a frame to the client the same way
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = testutils.sendMessageFromServer })
+  -- The next frame is only read correctly if the split one was read in full
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", data = testutils.sendingCustomTypesMessageFromServer })
+
+  client:disconnect()
+  testutils.pollEnd(co)
+end
+
+---Tests sending a routed frame too short to hold its header, which gets the client dropped.
+local function testMalformedFrame()
+  crypto.sleep(0.1)
+
+  local client = luadtp.client()
+  local co = client:connect(testutils.host, testutils.portMalformedFrame)
+  client._sock:send(util.encodeMessageSize(3) .. string.char(frame.kinds.routed, 0, 1))
+  testutils.pollUntil(co, { eventType = "disconnected" })
+  assert(not client:connected())
+  testutils.pollEnd(co)
+
+  -- The server keeps serving other clients
+  local other = luadtp.client()
+  local otherCo = other:connect(testutils.host, testutils.portMalformedFrame)
+  other:send(testutils.sendMessageFromClient)
+
+  crypto.sleep(0.1)
+  other:disconnect()
+  testutils.pollEnd(otherCo)
+end
+
 ---Runs all client tests.
 local function test()
   print("Beginning client tests")
@@ -309,6 +933,18 @@ local function test()
   testDecodeMessageSize()
   print("Testing crypto...")
   testCrypto()
+  print("Testing crypto FFI bindings...")
+  testCryptoFfi()
+  print("Testing buffers...")
+  testBuffer()
+  print("Testing stream outbox queues...")
+  testOutboxQueue()
+  print("Testing batch payloads...")
+  testBatchMessages()
+  print("Testing routed message tampering...")
+  testRoutedTampering()
+  print("Testing reactor starvation...")
+  testReactorStarvation()
   print("Testing client connecting...")
   testClientConnect()
   print("Testing send...")
@@ -331,6 +967,42 @@ local function test()
   testServerCleanupOnGC()
   print("Testing the README example...")
   testExample()
+  print("Testing keepalives...")
+  testKeepalive()
+  print("Testing shared memory...")
+  testShm()
+  print("Testing unreliable sending...")
+  testUnreliable()
+  print("Testing remote procedure calls...")
+  testRpc()
+  print("Testing streams...")
+  testStreams()
+  print("Testing raw sending...")
+  testRaw()
+  print("Testing capture...")
+  testCapture()
+  print("Testing replay...")
+  testReplay()
+  print("Testing state synchronization...")
+  testState()
+  print("Testing admission control...")
+  testAdmission()
+  print("Testing topics...")
+  testTopics()
+  print("Testing routed messages...")
+  testRouted()
+  print("Testing read limits...")
+  testReadLimits()
+  print("Testing batching...")
+  testBatch()
+  print("Testing reactor...")
+  testReactor()
+  print("Testing connection pools...")
+  testPool()
+  print("Testing split frames...")
+  testSplitFrame()
+  print("Testing malformed frames...")
+  testMalformedFrame()
 
   print("Completed client tests")
 end
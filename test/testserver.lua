@@ -1,4 +1,12 @@
 local luadtp = require("luadtp")
+---@module "src.crypto"
+local crypto = require("luadtp.crypto")
+---@module "src.util"
+local util = require("luadtp.util")
+---@module "src.frame"
+local frame = require("luadtp.frame")
+---@module "src.capture"
+local capture = require("luadtp.capture")
 local testutils = require("test.testutils")
 
 ---Tests that the server is able to start and serve clients.
@@ -214,6 +222,435 @@ local function testExample()
   server:stop()
 end
 
+---Tests scheduling, repeating and cancelling timers.
+local function testTimers()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portTimers)
+  print("Server address: ", server:getAddr())
+
+  local fired = {}
+  server:after(0.05, function () table.insert(fired, "after") end)
+  local cancelled = server:after(0.05, function () table.insert(fired, "cancelled") end)
+  cancelled:cancel()
+
+  local count = 0
+  local periodic
+  periodic = server:every(0.02, function ()
+    count = count + 1
+    if count == 3 then
+      periodic:cancel()
+    end
+  end)
+
+  for _ = 1, 30 do
+    testutils.pollNil(co)
+    crypto.sleep(0.01)
+  end
+
+  testutils.assertEq(fired, { "after" })
+  testutils.assertEq(count, 3)
+  assert(not periodic:pending())
+
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests that pinged clients stay connected and silent clients are disconnected.
+local function testKeepalive()
+  local server = luadtp.server()
+  server:setKeepalive(0.1)
+  server:setIdleTimeout(0.3)
+  local co = server:start(testutils.host, testutils.portKeepalive)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  testutils.pollUntilNotNilValue(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests communicating with a client through shared memory.
+local function testShm()
+  local server = luadtp.server()
+  local co = server:start(testutils.shmAddress)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  server:sendAll(testutils.sendMessageFromServer)
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = testutils.sendMessageFromClient })
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests sending data over the unreliable datagram channel.
+local function testUnreliable()
+  local server = luadtp.server()
+  server:enableUnreliable()
+  local co = server:start(testutils.host, testutils.portUnreliable)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  testutils.pollUntilNotNilValue(co, { eventType = "receiveUnreliable", clientId = 1, data = testutils.sendMessageFromClient })
+  server:sendUnreliable(testutils.sendMessageFromServer, 1)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests answering remote procedure calls.
+local function testRpc()
+  local server = luadtp.server()
+  server:handle("add", function (args, clientId)
+    testutils.assertEq(clientId, 1)
+    return args[1] + args[2]
+  end)
+  server:handle("fail", function ()
+    error("failed on purpose", 0)
+  end)
+  local co = server:start(testutils.host, testutils.portRpc)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests that small stream messages are not held up behind large ones.
+local function testStreams()
+  local bulk = string.rep("bulk data ", 100000)
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portStreams)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  -- The bulk message was queued first, but the urgent message's stream is weighted higher
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = "urgent", stream = 2 })
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = bulk, stream = 1 })
+
+  server:sendStream(1, bulk, 1)
+  server:sendStream(1, "after bulk", 1)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests sending raw bytes without serialization.
+local function testRaw()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portRaw)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRaw")
+  testutils.assertEq(event.clientId, 1)
+  testutils.assertEq(event.data:sub(), testutils.rawMessageFromClient)
+  server:sendRaw(testutils.rawMessageFromServer, 1)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests capturing the traffic received from a client.
+local function testCapture()
+  local path = os.tmpname()
+  local server = luadtp.server()
+  server:startCapture(path)
+  local co = server:start(testutils.host, testutils.portCapture)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = testutils.sendMessageFromClient })
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stopCapture()
+  server:stop()
+  testutils.pollEnd(co)
+
+  local records = {}
+  for record in capture.records(path) do
+    records[#records + 1] = record
+  end
+  os.remove(path)
+
+  testutils.assertEq(#records, 3)
+  testutils.assertEq({ records[1].clientId, records[1].type }, { 1, capture.recordTypes.connect })
+  testutils.assertEq({ records[2].clientId, records[2].type }, { 1, frame.kinds.data })
+  testutils.assertEq(util.deserialize(records[2].data), testutils.sendMessageFromClient)
+  testutils.assertEq({ records[3].clientId, records[3].type }, { 1, capture.recordTypes.disconnect })
+  assert(records[1].time <= records[2].time and records[2].time <= records[3].time)
+end
+
+---Tests serving traffic replayed from a capture.
+local function testReplay()
+  local server = luadtp.server()
+  server:handle("add", function (args)
+    return args[1] + args[2]
+  end)
+  local co = server:start(testutils.host, testutils.portReplay)
+  print("Server address: ", server:getAddr())
+
+  local connected, received, disconnected = 0, 0, 0
+  while disconnected < testutils.replayClients do
+    local event = testutils.pollUntilNotNil(co)
+
+    if event.eventType == "connect" then
+      connected = connected + 1
+    elseif event.eventType == "receive" then
+      testutils.assertEq(event.data, testutils.sendMessageFromClient)
+      received = received + 1
+    elseif event.eventType == "disconnect" then
+      disconnected = disconnected + 1
+    end
+  end
+
+  testutils.assertEq(connected, testutils.replayClients)
+  testutils.assertEq(received, testutils.replayClients)
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests publishing state to a client.
+local function testState()
+  local server = luadtp.server()
+  server:publishState("game", testutils.initialStateFromServer)
+  local co = server:start(testutils.host, testutils.portState)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  server:publishState("game", testutils.initialStateFromServer)
+  server:publishState("game", testutils.changedStateFromServer)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests rejecting connections beyond the admission limits.
+local function testAdmission()
+  local server = luadtp.server()
+  server:setAdmissionLimits({ maxClients = 1, acceptRate = 100 })
+  local co = server:start(testutils.host, testutils.portAdmission)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  -- The second client is rejected without being reported
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests publishing data to the subscribers of a topic.
+local function testTopics()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portTopics)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  server:publish("news", testutils.sendMessageFromServer)
+  testutils.pollUntil(co, { eventType = "subscribe", clientId = 1, topic = "news" })
+  server:publish("sports", testutils.sendMessageFromServer)
+  server:publish("news", testutils.publishMessageFromServer)
+
+  testutils.pollUntil(co, { eventType = "unsubscribe", clientId = 1, topic = "news" })
+  server:publish("news", testutils.sendMessageFromServer)
+  server:sendAll(testutils.sendMessageFromServer)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests routing messages by their header.
+local function testRouted()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portRouted)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+  testutils.pollUntil(co, { eventType = "subscribe", clientId = 1, topic = "room" })
+
+  -- The first message is dropped without being opened
+  local event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRouted")
+  testutils.assertEq({ event.message.type, event.message.routingKey }, { 1, 7 })
+
+  event = testutils.pollUntilNotNil(co)
+  testutils.assertEq(event.eventType, "receiveRouted")
+  testutils.assertEq({ event.message.type, event.message.routingKey }, { 2, 9 })
+  server:forward(event.message, 1)
+  server:forwardToTopic("room", event.message)
+  testutils.assertEq(event.message:data(), testutils.sendMessageFromClient)
+  server:sendRouted(3, 42, testutils.sendMessageFromServer, 1)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests reading from a client under tight read limits.
+local function testReadLimits()
+  local server = luadtp.server()
+  server:setReadLimits({ framesPerTurn = 1, bytesPerTurn = 256, bytesPerSecond = 65536, burstBytes = 8192 })
+  local co = server:start(testutils.host, testutils.portReadLimits)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  for i = 1, testutils.readLimitsMessages do
+    local data = { i, string.rep("x", testutils.readLimitsMessageSize) }
+    testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = data })
+  end
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests sending and receiving batched messages.
+local function testBatch()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portBatch)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  for i = 1, testutils.batchMessages do
+    testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = i })
+  end
+
+  server:beginBatch()
+  for i = 1, testutils.batchMessages do
+    server:send(-i, 1)
+  end
+  server:flushBatch()
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests serving clients from a reactor.
+local function testReactor()
+  local server = luadtp.server()
+  local reactor = luadtp.reactor()
+  reactor:add(server, server:start(testutils.host, testutils.portReactor))
+  print("Server address: ", server:getAddr())
+
+  local connects, disconnects, received = 0, 0, {}
+
+  while disconnects < 2 do
+    for _, event in ipairs(reactor:poll(1)) do
+      testutils.assertEq(event.source, server)
+
+      if event.eventType == "connect" then
+        connects = connects + 1
+      elseif event.eventType == "receive" then
+        received[event.clientId] = event.data
+        server:send(event.data, event.clientId)
+      elseif event.eventType == "disconnect" then
+        disconnects = disconnects + 1
+      end
+    end
+  end
+
+  testutils.assertEq(connects, 2)
+  testutils.assertEq(received, { testutils.multipleClientsMessageFromClient1, testutils.multipleClientsMessageFromClient2 })
+
+  server:stop()
+  testutils.assertEq(reactor:poll(0), {})
+  testutils.assertEq(reactor:count(), 0)
+end
+
+---Tests serving the connections of a client connection pool.
+local function testPool()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portPool)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+  testutils.pollUntil(co, { eventType = "connect", clientId = 2 })
+
+  -- Messages are spread over the pool's connections, which are opened at the same time and so may be admitted in either order
+  local received = {}
+
+  while received[1] == nil or received[2] == nil do
+    local event = testutils.pollUntilNotNil(co)
+    testutils.assertEq(event.eventType, "receive")
+    received[event.clientId] = event.data
+  end
+
+  local first = 1
+  if received[2] == testutils.multipleClientsMessageFromClient1 then
+    first = 2
+  end
+
+  testutils.assertEq(received[first], testutils.multipleClientsMessageFromClient1)
+  testutils.assertEq(received[3 - first], testutils.multipleClientsMessageFromClient2)
+
+  -- The pool replaces the dropped connection
+  server:removeClient(first)
+  testutils.pollUntil(co, { eventType = "connect", clientId = 3 })
+  testutils.pollUntil(co, { eventType = "receive", clientId = 3, data = testutils.sendMessageFromClient })
+  server:send(testutils.sendMessageFromServer, 3)
+
+  local disconnected = {}
+
+  while disconnected[3 - first] == nil or disconnected[3] == nil do
+    local event = testutils.pollUntilNotNil(co)
+    testutils.assertEq(event.eventType, "disconnect")
+    disconnected[event.clientId] = true
+  end
+
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests receiving frames whose size prefix and body arrive in separate pieces.
+local function testSplitFrame()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portSplitFrame)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = testutils.sendMessageFromClient })
+  -- The next frame is only read correctly if the split one was read in full
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 1, data = testutils.sendingCustomTypesMessageFromClient })
+
+  -- Split a frame to the client the same way
+  local client = server._clients[1]
+  local encoded = frame.encode(client.key, frame.kinds.data, util.serialize(testutils.sendMessageFromServer))
+  client.conn:send(string.sub(encoded, 1, 3))
+  crypto.sleep(0.1)
+  client.conn:send(string.sub(encoded, 4, util.lenSize + 8))
+  crypto.sleep(0.1)
+  client.conn:send(string.sub(encoded, util.lenSize + 9))
+
+  server:send(testutils.sendingCustomTypesMessageFromServer, 1)
+
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+  server:stop()
+  testutils.pollEnd(co)
+end
+
+---Tests that a client sending a frame too short to hold its header is dropped without affecting other clients.
+local function testMalformedFrame()
+  local server = luadtp.server()
+  local co = server:start(testutils.host, testutils.portMalformedFrame)
+  print("Server address: ", server:getAddr())
+  testutils.pollUntil(co, { eventType = "connect", clientId = 1 })
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 1 })
+
+  testutils.pollUntil(co, { eventType = "connect", clientId = 2 })
+  testutils.pollUntilNotNilValue(co, { eventType = "receive", clientId = 2, data = testutils.sendMessageFromClient })
+  testutils.pollUntil(co, { eventType = "disconnect", clientId = 2 })
+
+  server:stop()
+  testutils.pollEnd(co)
+end
+
 ---Runs all server tests.
 local function test()
   print("Beginning server tests")
@@ -242,6 +679,44 @@ local function test()
   testServerCleanupOnGC()
   print("Testing the README example...")
   testExample()
+  print("Testing keepalives...")
+  testKeepalive()
+  print("Testing shared memory...")
+  testShm()
+  print("Testing unreliable sending...")
+  testUnreliable()
+  print("Testing remote procedure calls...")
+  testRpc()
+  print("Testing streams...")
+  testStreams()
+  print("Testing raw sending...")
+  testRaw()
+  print("Testing capture...")
+  testCapture()
+  print("Testing replay...")
+  testReplay()
+  print("Testing state synchronization...")
+  testState()
+  print("Testing admission control...")
+  testAdmission()
+  print("Testing topics...")
+  testTopics()
+  print("Testing routed messages...")
+  testRouted()
+  print("Testing read limits...")
+  testReadLimits()
+  print("Testing batching...")
+  testBatch()
+  print("Testing reactor...")
+  testReactor()
+  print("Testing connection pools...")
+  testPool()
+  print("Testing split frames...")
+  testSplitFrame()
+  print("Testing malformed frames...")
+  testMalformedFrame()
+  print("Testing timers...")
+  testTimers()
 
   print("Completed server tests")
 end
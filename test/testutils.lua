@@ -220,6 +220,25 @@ return {
   portClientCleanupOnGC = 33010,
   portServerCleanupOnGC = 33011,
   portExample = 33012,
+  portTimers = 33013,
+  portKeepalive = 33014,
+  shmAddress = "shm://luadtp-test",
+  portUnreliable = 33015,
+  portRpc = 33016,
+  portStreams = 33017,
+  portRaw = 33018,
+  portCapture = 33019,
+  portReplay = 33020,
+  portState = 33021,
+  portAdmission = 33022,
+  portTopics = 33023,
+  portRouted = 33024,
+  portReadLimits = 33025,
+  portBatch = 33026,
+  portReactor = 33027,
+  portPool = 33028,
+  portSplitFrame = 33029,
+  portMalformedFrame = 33030,
   sendMessageFromServer = 29275,
   sendMessageFromClient = "Hello, server!",
   sendingCustomTypesMessageFromServer = { a = 123, b = "Hello, custom server type!", c = { "first server item", "second server item" } },
@@ -227,6 +246,15 @@ return {
   multipleClientsMessageFromServer = 29275,
   multipleClientsMessageFromClient1 = "Hello from client #1",
   multipleClientsMessageFromClient2 = "Goodbye from client #2",
+  rawMessageFromServer = "\0\1\2 raw bytes from the server \253\254\255",
+  replayClients = 3,
+  readLimitsMessages = 32,
+  readLimitsMessageSize = 1000,
+  batchMessages = 100,
+  initialStateFromServer = { score = 1, players = { "alice", "bob" }, round = { number = 1, ending = false } },
+  publishMessageFromServer = { headline = "Hello, subscribers!" },
+  changedStateFromServer = { score = 2, players = { "alice", "bob" }, winner = "alice" },
+  rawMessageFromClient = "\255\254\253 raw bytes from the client \2\1\0",
   print_r = print_r,
   equals = equals,
   assertEq = assertEq,